@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "tryptobot.h"
+#include "last_roll.h"
+#include "roll_log.h"
+
+/*
+ (after main.py has built libtryptobot.so)
+ gcc bench_handle_message.c -o bench-handle-message.x86 -Wall -std=gnu11 \
+   -O2 -L. -ltryptobot -Wl,-rpath,'$ORIGIN'
+ ./bench-handle-message.x86 [-n rounds] [-w warmup rounds] [-l label] \
+   [corpus file]
+
+ Replays a corpus of messages through handle_message() and prints one
+ JSON object per line: one for each command in the corpus and a final
+ one for the whole corpus, each with the throughput, latency
+ percentiles, and heap allocations per message, so results from two
+ commits can be compared with any JSON tool (the backend's own
+ diagnostics go to stderr, so 2>/dev/null hides them). The corpus file holds one
+ message per line (e.g. recorded from the bot); without one, a
+ synthetic corpus is used that covers every command and a query of
+ every section of every sheet in charsheets/. Must be run from the
+ root of the repo. The last rolls that %roll and %reroll save and the
+ roll log that %rollstats reports on are kept in a temporary
+ directory that is removed at exit, so the bot's own
+ lastrolls.bin and rolllog.bin are never touched.
+ */
+
+/**
+ * Allocation counting. Defining these in the executable overrides
+ * them for libtryptobot.so too, since the dynamic linker resolves
+ * every library's malloc() to the first definition it finds.
+ * =======================================================
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t alloc_ct = 0;
+static size_t alloc_bytes = 0;
+
+void *malloc(size_t size) {
+  alloc_ct++;
+  alloc_bytes += size;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+  alloc_ct++;
+  alloc_bytes += n * size;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  alloc_ct++;
+  alloc_bytes += size;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+  __libc_free(ptr);
+}
+
+/**
+ * Scratch state. Points the saved last rolls and the roll log at a
+ * temporary directory before the first message is handled, so the
+ * benchmark's rolls never land in the bot's real files. The cleanup
+ * is registered before the backend registers its own exit-time flush,
+ * so it runs after that flush.
+ * =======================================================
+ */
+static char state_dir[] = "/tmp/tryptobot-bench-XXXXXX";
+static char last_roll_path[sizeof(state_dir) + 32];
+static char last_roll_tmp_path[sizeof(state_dir) + 32];
+static char roll_log_path[sizeof(state_dir) + 32];
+
+static void remove_state_dir(void) {
+  unlink(last_roll_path);
+  unlink(last_roll_tmp_path);
+  unlink(roll_log_path);
+  rmdir(state_dir);
+}
+
+static int use_scratch_state(void) {
+  if (mkdtemp(state_dir) == NULL) return -1;
+  snprintf(
+    last_roll_path, sizeof(last_roll_path), "%s/lastrolls.bin", state_dir
+  );
+  snprintf(
+    last_roll_tmp_path, sizeof(last_roll_tmp_path),
+    "%s/lastrolls.bin.tmp", state_dir
+  );
+  snprintf(roll_log_path, sizeof(roll_log_path), "%s/rolllog.bin", state_dir);
+  atexit(remove_state_dir);
+  if (setenv(LAST_ROLL_PATH_ENV, last_roll_path, 1)
+      || setenv(ROLL_LOG_PATH_ENV, roll_log_path, 1)) {
+    return -1;
+  }
+  return 0;
+}
+
+static const char *synthetic_msgs[] = {
+  "%roll 1d20",
+  "%roll 4d6+2",
+  "%roll 100d100+50",
+  "%roll 3d6+2d4",
+  "%roll 4d6kh3 10x1d6",
+  "%roll shookspeared skills.arcana",
+  "%reroll",
+  "%odds 4d6kh3",
+  "%odds 1d20+5 15",
+  "%simulate 4d6kh3 10000 42",
+  "%rollstats",
+  "%rollstats all d20",
+  "%reverse the quick brown fox jumps over the lazy dog",
+  "%reverse héllo wörld, ça va?",
+  "%calcmod 15",
+  "%commands",
+  "%cmdinfo %roll",
+  "%cmdinfo roll",
+  "%dnd wtf",
+  "%stats",
+  "%bogus command",
+};
+#define SYNTHETIC_MSG_CT (sizeof(synthetic_msgs) / sizeof(synthetic_msgs[0]))
+
+typedef struct corpus {
+  char **msgs;
+  size_t size;
+  size_t cap;
+} corpus_t;
+
+static void corpus_add(corpus_t *c, const char *msg, size_t len) {
+  if (c->size == c->cap) {
+    c->cap = c->cap ? c->cap * 2 : 64;
+    c->msgs = realloc(c->msgs, c->cap * sizeof(char *));
+  }
+  c->msgs[c->size] = malloc(len + 1);
+  memcpy(c->msgs[c->size], msg, len);
+  c->msgs[c->size][len] = '\0';
+  c->size++;
+}
+
+// adds `%dnd query <sheet> [section]` for every section of every sheet
+static void add_charsheet_queries(corpus_t *c) {
+  DIR *dir = opendir("charsheets");
+  if (dir == NULL) {
+    fprintf(stderr, "Unable to open charsheets/; skipping %%dnd queries\n");
+    return;
+  }
+  struct dirent *entry;
+  char msg[512];
+  while ((entry = readdir(dir)) != NULL) {
+    size_t name_len = strlen(entry->d_name);
+    if (name_len < 5 || strcmp(entry->d_name + name_len - 4, ".dnd"))
+      continue;
+    int sheet_len = name_len - 4;
+    int len = snprintf(
+      msg, sizeof(msg), "%%dnd query %.*s", sheet_len, entry->d_name
+    );
+    corpus_add(c, msg, len);
+
+    snprintf(msg, sizeof(msg), "charsheets/%s", entry->d_name);
+    FILE *sheet = fopen(msg, "r");
+    if (sheet == NULL) continue;
+    char line[512];
+    char section[256];
+    while (fgets(line, sizeof(line), sheet)) {
+      if (sscanf(line, " @section %255[^: \n]", section) == 1) {
+        len = snprintf(
+          msg, sizeof(msg), "%%dnd query %.*s %s",
+          sheet_len, entry->d_name, section
+        );
+        corpus_add(c, msg, len);
+      }
+    }
+    fclose(sheet);
+  }
+  closedir(dir);
+}
+
+static int load_corpus_file(corpus_t *c, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return -1;
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_cap, file)) >= 0) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) len--;
+    if (len > 0) corpus_add(c, line, len);
+  }
+  free(line);
+  fclose(file);
+  return 0;
+}
+
+// per-command results; a command is the first word of a message
+#define MAX_GROUPS 64
+
+typedef struct group {
+  char name[32];
+  size_t msg_ct;
+  size_t allocs;
+  size_t alloc_bytes;
+  double elapsed_secs;
+  unsigned long long *latencies; // in ns, one per message handled
+} group_t;
+
+static group_t groups[MAX_GROUPS + 1]; // the last one is for the whole corpus
+static size_t group_ct = 0;
+
+static group_t *group_for(const char *msg) {
+  char name[32];
+  while (*msg == ' ') msg++;
+  size_t len = strcspn(msg, " ");
+  if (len >= sizeof(name)) len = sizeof(name) - 1;
+  memcpy(name, msg, len);
+  name[len] = '\0';
+  // keep the name safe to print inside a JSON string
+  for (size_t i = 0; i < len; i++) {
+    if (name[i] == '"' || name[i] == '\\' || (unsigned char) name[i] < 0x20)
+      name[i] = '?';
+  }
+  for (size_t i = 0; i < group_ct; i++) {
+    if (!strcmp(groups[i].name, name)) return groups + i;
+  }
+  if (group_ct == MAX_GROUPS) return NULL;
+  strcpy(groups[group_ct].name, name);
+  return groups + group_ct++;
+}
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_ull(const void *a, const void *b) {
+  unsigned long long x = *(const unsigned long long *) a;
+  unsigned long long y = *(const unsigned long long *) b;
+  return (x > y) - (x < y);
+}
+
+static unsigned long long percentile(const group_t *g, double fraction) {
+  size_t i = (size_t) (fraction * g->msg_ct);
+  if (i >= g->msg_ct) i = g->msg_ct - 1;
+  return g->latencies[i];
+}
+
+static void print_group(const group_t *g, const char *label, size_t rounds) {
+  if (g->msg_ct == 0) return;
+  qsort(g->latencies, g->msg_ct, sizeof(unsigned long long), compare_ull);
+  printf(
+    "{\"bench\": \"handle_message\", \"label\": \"%s\", "
+    "\"command\": \"%s\", \"rounds\": %lu, \"msgs\": %lu, "
+    "\"msgs_per_sec\": %.0f, \"p50_ns\": %llu, \"p90_ns\": %llu, "
+    "\"p99_ns\": %llu, \"max_ns\": %llu, \"allocs_per_msg\": %.2f, "
+    "\"alloc_bytes_per_msg\": %.1f}\n",
+    label, g->name, rounds, g->msg_ct,
+    g->msg_ct / g->elapsed_secs,
+    percentile(g, 0.50), percentile(g, 0.90), percentile(g, 0.99),
+    g->latencies[g->msg_ct - 1],
+    (double) g->allocs / g->msg_ct,
+    (double) g->alloc_bytes / g->msg_ct
+  );
+}
+
+int main(int argc, char *argv[]) {
+  size_t rounds = 200;
+  size_t warmup_rounds = 5;
+  const char *label = "";
+  const char *corpus_path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      rounds = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+      warmup_rounds = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+      label = argv[++i];
+    } else if (argv[i][0] != '-') {
+      corpus_path = argv[i];
+    } else {
+      fprintf(
+        stderr,
+        "usage: %s [-n rounds] [-w warmup rounds] [-l label] [corpus file]\n",
+        argv[0]
+      );
+      return 1;
+    }
+  }
+  if (rounds == 0) rounds = 1;
+  if (use_scratch_state()) {
+    fprintf(stderr, "Unable to make a scratch state directory\n");
+    return 1;
+  }
+
+  corpus_t corpus = { NULL, 0, 0 };
+  if (corpus_path != NULL) {
+    if (load_corpus_file(&corpus, corpus_path)) {
+      fprintf(stderr, "Unable to read corpus `%s`\n", corpus_path);
+      return 1;
+    }
+  } else {
+    for (size_t i = 0; i < SYNTHETIC_MSG_CT; i++) {
+      corpus_add(&corpus, synthetic_msgs[i], strlen(synthetic_msgs[i]));
+    }
+    add_charsheet_queries(&corpus);
+  }
+  if (corpus.size == 0) {
+    fprintf(stderr, "Corpus is empty\n");
+    return 1;
+  }
+
+  // resolve each message's group up front so it isn't timed
+  group_t **msg_groups = malloc(corpus.size * sizeof(group_t *));
+  for (size_t i = 0; i < corpus.size; i++) {
+    msg_groups[i] = group_for(corpus.msgs[i]);
+  }
+  group_t *total = groups + MAX_GROUPS;
+  strcpy(total->name, "(all)");
+  for (size_t g = 0; g < group_ct; g++) {
+    size_t ct = 0;
+    for (size_t i = 0; i < corpus.size; i++) ct += msg_groups[i] == groups + g;
+    groups[g].latencies = malloc(ct * rounds * sizeof(unsigned long long));
+  }
+  total->latencies = malloc(corpus.size * rounds * sizeof(unsigned long long));
+
+  // fills caches (command catalog, page cache, ...) before measuring
+  for (size_t r = 0; r < warmup_rounds; r++) {
+    for (size_t i = 0; i < corpus.size; i++) free(handle_message(corpus.msgs[i]));
+  }
+
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < corpus.size; i++) {
+      size_t allocs_before = alloc_ct;
+      size_t bytes_before = alloc_bytes;
+      unsigned long long start = now_ns();
+      free(handle_message(corpus.msgs[i]));
+      unsigned long long elapsed = now_ns() - start;
+
+      group_t *targets[] = { msg_groups[i], total };
+      for (int t = 0; t < 2; t++) {
+        group_t *g = targets[t];
+        if (g == NULL) continue;
+        g->latencies[g->msg_ct++] = elapsed;
+        g->elapsed_secs += elapsed / 1e9;
+        g->allocs += alloc_ct - allocs_before;
+        g->alloc_bytes += alloc_bytes - bytes_before;
+      }
+    }
+  }
+
+  for (size_t g = 0; g < group_ct; g++) print_group(groups + g, label, rounds);
+  print_group(total, label, rounds);
+  return 0;
+}
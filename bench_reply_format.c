@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "tryptobot.h"
+#include "strbuf.h"
+#include "dice.h"
+#include "dice_expr.h"
+#include "charsheet_cache.h"
+#include "last_roll.h"
+#include "roll_log.h"
+
+/*
+ (after main.py has built libtryptobot.so)
+ gcc bench_reply_format.c -o bench-reply-format.x86 -Wall -std=gnu11 \
+   -O2 -L. -ltryptobot -Wl,-rpath,'$ORIGIN'
+ ./bench-reply-format.x86 [-n iterations] [-l label]
+
+ For each reply that tryptobot.c builds from fragments, sends the
+ message through handle_message_into(), so the real command handler
+ runs, and times that. It also times building the same reply into a
+ reused strbuf_t once with strbuf_printf() (how it used to be built)
+ and once with the fragment appenders in strbuf.h (how the handler
+ builds it now), which is the formatting alone: no dispatch, rolling,
+ logging or lookups. To keep those two honest, the dice are rolled
+ first on this thread's generator with a fixed seed, the handler is
+ run with the same seed, and both must produce exactly the handler's
+ reply, or it's an error. Prints one JSON object per reply with the
+ best time per reply of each over a few runs. Must be run from the
+ root of the repo (so charsheets/ is found). The last rolls and roll
+ log that the handler runs save to are kept in a temporary directory
+ that is removed at exit, not in the bot's own lastrolls.bin and
+ rolllog.bin.
+ */
+
+#define RUNS 5
+#define SEED 42
+#define REPEATS_MAX 10
+
+/**
+ * Scratch state. Points the saved last rolls and the roll log at a
+ * temporary directory before the first message is handled, so the
+ * benchmark's rolls never land in the bot's real files. The cleanup
+ * is registered before the backend registers its own exit-time flush,
+ * so it runs after that flush.
+ * ===================================================================
+ */
+static char state_dir[] = "/tmp/tryptobot-bench-XXXXXX";
+static char last_roll_path[sizeof(state_dir) + 32];
+static char last_roll_tmp_path[sizeof(state_dir) + 32];
+static char roll_log_path[sizeof(state_dir) + 32];
+
+static void remove_state_dir(void) {
+  unlink(last_roll_path);
+  unlink(last_roll_tmp_path);
+  unlink(roll_log_path);
+  rmdir(state_dir);
+}
+
+static int use_scratch_state(void) {
+  if (mkdtemp(state_dir) == NULL) return -1;
+  snprintf(
+    last_roll_path, sizeof(last_roll_path), "%s/lastrolls.bin", state_dir
+  );
+  snprintf(
+    last_roll_tmp_path, sizeof(last_roll_tmp_path),
+    "%s/lastrolls.bin.tmp", state_dir
+  );
+  snprintf(roll_log_path, sizeof(roll_log_path), "%s/rolllog.bin", state_dir);
+  atexit(remove_state_dir);
+  if (setenv(LAST_ROLL_PATH_ENV, last_roll_path, 1)
+      || setenv(ROLL_LOG_PATH_ENV, roll_log_path, 1)) {
+    return -1;
+  }
+  return 0;
+}
+
+// what each reply is built from, as the handler would have it
+typedef struct reply_sample {
+  diceroll_t rolls[REPEATS_MAX];
+  int roll_ct;
+  const char *sheet, *field;
+  int ability_score, modifier;
+} reply_sample_t;
+
+static reply_sample_t sample;
+
+/**
+ * Each reply, both ways. The *_printf versions are the format strings
+ * the commands used before they were switched to fragments; the
+ * *_fragments versions are what the commands do now.
+ * ===================================================================
+ */
+static void put_result_printf(strbuf_t *out, const diceroll_t *diceroll) {
+  strbuf_printf(
+    out,
+    "Result of rolling %s: %lld",
+    diceroll->expr, diceroll->value
+  );
+  if (diceroll->term_ct > 1) {
+    strbuf_puts(out, " (");
+    for (int i = 0; i < diceroll->term_ct && i < DICE_TERMS_MAX; i++) {
+      const dice_term_total_t *term = diceroll->terms + i;
+      strbuf_printf(
+        out,
+        "%s%.*s: %lld",
+        i ? ", " : "",
+        term->label_len, diceroll->expr + term->label_start,
+        term->value
+      );
+    }
+    strbuf_puts(out, diceroll->term_ct > DICE_TERMS_MAX ? ", ...)" : ")");
+  }
+}
+
+static void put_result_fragments(strbuf_t *out, const diceroll_t *diceroll) {
+  strbuf_concat(out, "Result of rolling ", diceroll->expr, ": ", NULL);
+  strbuf_append_int(out, diceroll->value);
+  if (diceroll->term_ct > 1) {
+    strbuf_put_lit(out, " (");
+    for (int i = 0; i < diceroll->term_ct && i < DICE_TERMS_MAX; i++) {
+      const dice_term_total_t *term = diceroll->terms + i;
+      if (i) strbuf_put_lit(out, ", ");
+      strbuf_append(
+        out,
+        diceroll->expr + term->label_start, term->label_len
+      );
+      strbuf_put_lit(out, ": ");
+      strbuf_append_int(out, term->value);
+    }
+    strbuf_puts(out, diceroll->term_ct > DICE_TERMS_MAX ? ", ...)" : ")");
+  }
+}
+
+static void roll_printf(strbuf_t *out, const reply_sample_t *s) {
+  put_result_printf(out, s->rolls);
+}
+
+static void roll_fragments(strbuf_t *out, const reply_sample_t *s) {
+  put_result_fragments(out, s->rolls);
+}
+
+static void roll_repeats_printf(strbuf_t *out, const reply_sample_t *s) {
+  long long total = 0;
+  strbuf_printf(
+    out,
+    "Results of rolling %dx%s: ",
+    s->roll_ct, s->rolls[0].expr
+  );
+  for (int r = 0; r < s->roll_ct; r++) {
+    strbuf_printf(out, "%s%lld", r ? ", " : "", s->rolls[r].value);
+    total += s->rolls[r].value;
+  }
+  strbuf_printf(out, " (total %lld)", total);
+}
+
+static void roll_repeats_fragments(strbuf_t *out, const reply_sample_t *s) {
+  long long total = 0;
+  strbuf_put_lit(out, "Results of rolling ");
+  strbuf_append_int(out, s->roll_ct);
+  strbuf_concat(out, "x", s->rolls[0].expr, ": ", NULL);
+  for (int r = 0; r < s->roll_ct; r++) {
+    if (r) strbuf_put_lit(out, ", ");
+    strbuf_append_int(out, s->rolls[r].value);
+    total += s->rolls[r].value;
+  }
+  strbuf_put_lit(out, " (total ");
+  strbuf_append_int(out, total);
+  strbuf_putc(out, ')');
+}
+
+static void roll_sheet_printf(strbuf_t *out, const reply_sample_t *s) {
+  strbuf_printf(out, "**%s** %s: ", s->sheet, s->field);
+  put_result_printf(out, s->rolls);
+}
+
+static void roll_sheet_fragments(strbuf_t *out, const reply_sample_t *s) {
+  strbuf_concat(out, "**", s->sheet, "** ", s->field, ": ", NULL);
+  put_result_fragments(out, s->rolls);
+}
+
+static void calcmod_printf(strbuf_t *out, const reply_sample_t *s) {
+  strbuf_printf(
+    out,
+    "Modifier for Ability score %d: %d",
+    s->ability_score, s->modifier
+  );
+}
+
+static void calcmod_fragments(strbuf_t *out, const reply_sample_t *s) {
+  strbuf_put_lit(out, "Modifier for Ability score ");
+  strbuf_append_int(out, s->ability_score);
+  strbuf_put_lit(out, ": ");
+  strbuf_append_int(out, s->modifier);
+}
+
+typedef void (*format_fn_t)(strbuf_t *, const reply_sample_t *);
+
+static const struct {
+  const char *msg;
+  // what the handler rolls, and how many times; NULL if it doesn't roll
+  const char *expr;
+  int repeats;
+  const char *sheet, *field; // what the roll comes from, if a sheet
+  format_fn_t with_printf, with_fragments;
+} replies[] = {
+  { "%roll 3d6+2d4", "3d6+2d4", 1, NULL, NULL,
+    roll_printf, roll_fragments },
+  { "%roll 10x1d6", "1d6", 10, NULL, NULL,
+    roll_repeats_printf, roll_repeats_fragments },
+  { "%roll shookspeared skills.arcana", NULL, 1,
+    "shookspeared", "skills.arcana", roll_sheet_printf, roll_sheet_fragments },
+  { "%calcmod 15", NULL, 0, NULL, NULL, calcmod_printf, calcmod_fragments },
+};
+#define REPLY_CT (sizeof(replies) / sizeof(replies[0]))
+
+/**
+ * Fills in sample for reply i by rolling what its handler rolls, on
+ * this thread's generator seeded with SEED. Returns -1 if it can't be
+ * rolled.
+ */
+static int prepare_sample(size_t i) {
+  static char sheet_expr[CHARSHEET_EXPR_MAX];
+  const char *expr = replies[i].expr;
+  memset(&sample, 0, sizeof(sample));
+  sample.ability_score = 15;
+  sample.modifier = 2;
+  sample.sheet = replies[i].sheet;
+  sample.field = replies[i].field;
+  if (sample.sheet != NULL) {
+    if (charsheet_roll_expr(sample.sheet, sample.field, sheet_expr)) return -1;
+    expr = sheet_expr;
+  }
+  if (expr == NULL) return 0;
+  dice_rng_seed(dice_thread_rng(), SEED);
+  for (int r = 0; r < replies[i].repeats; r++) {
+    if (roll_dice_expr(expr, sample.rolls + r)) return -1;
+  }
+  sample.roll_ct = replies[i].repeats;
+  return 0;
+}
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// best time per reply over RUNS runs of iterations replies each
+static double time_format(
+  format_fn_t format,
+  strbuf_t *out,
+  size_t iterations
+) {
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    unsigned long long start = now_ns();
+    for (size_t i = 0; i < iterations; i++) {
+      strbuf_clear(out);
+      format(out, &sample);
+    }
+    double per_reply = (double) (now_ns() - start) / iterations;
+    if (run == 0 || per_reply < best) best = per_reply;
+  }
+  return best;
+}
+
+// the same, for the whole handler
+static double time_handler(const char *msg, strbuf_t *out, size_t iterations) {
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    unsigned long long start = now_ns();
+    for (size_t i = 0; i < iterations; i++) {
+      strbuf_clear(out);
+      handle_message_into(msg, out);
+    }
+    double per_reply = (double) (now_ns() - start) / iterations;
+    if (run == 0 || per_reply < best) best = per_reply;
+  }
+  return best;
+}
+
+/**
+ * Checks that format builds exactly the reply in expected, which as
+ * handle_message_into() leaves it counts the reply's '\0' in its len.
+ */
+static int check_format(
+  size_t i,
+  const char *method,
+  format_fn_t format,
+  const strbuf_t *expected,
+  strbuf_t *out
+) {
+  strbuf_clear(out);
+  format(out, &sample);
+  if (expected->len == out->len + 1
+      && !memcmp(expected->data, out->data, expected->len)) {
+    return 0;
+  }
+  fprintf(
+    stderr,
+    "%s (%s): \"%s\" != \"%s\"\n",
+    replies[i].msg, method, out->data, expected->data
+  );
+  return -1;
+}
+
+int main(int argc, char *argv[]) {
+  size_t iterations = 1000000;
+  const char *label = "";
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      iterations = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+      label = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [-n iterations] [-l label]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (iterations == 0) iterations = 1;
+  if (use_scratch_state()) {
+    fprintf(stderr, "Unable to make a scratch state directory\n");
+    return 1;
+  }
+
+  strbuf_t expected = { 0 }, out = { 0 };
+  for (size_t i = 0; i < REPLY_CT; i++) {
+    if (prepare_sample(i)) {
+      fprintf(stderr, "%s: can't roll what it rolls\n", replies[i].msg);
+      return 1;
+    }
+    strbuf_clear(&expected);
+    dice_rng_seed(dice_thread_rng(), SEED);
+    handle_message_into(replies[i].msg, &expected);
+    if (check_format(i, "printf", replies[i].with_printf, &expected, &out)
+        || check_format(
+          i, "fragments", replies[i].with_fragments, &expected, &out
+        )) {
+      return 1;
+    }
+
+    double handler_ns = time_handler(replies[i].msg, &out, iterations);
+    double printf_ns = time_format(replies[i].with_printf, &out, iterations);
+    double fragments_ns =
+      time_format(replies[i].with_fragments, &out, iterations);
+    printf(
+      "{\"bench\": \"reply_format\", \"label\": \"%s\", \"reply\": \"%s\", "
+      "\"iterations\": %lu, \"handler_ns\": %.1f, \"printf_ns\": %.1f, "
+      "\"fragments_ns\": %.1f, \"speedup\": %.2f}\n",
+      label, replies[i].msg, iterations,
+      handler_ns, printf_ns, fragments_ns, printf_ns / fragments_ns
+    );
+  }
+  strbuf_free(&expected);
+  strbuf_free(&out);
+  return 0;
+}
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "tryptobot.h"
+#include "dndml/dnd_input_reader.h"
+#include "dndml/dnd_charsheet.h"
+#include "dndml/dnd_lexer.h"
+#include "dndml/dnd_parser.h"
+#include "file_cache.h"
+#include "charsheet_cache.h"
+
+// longest sheet name looked up; real ones are a word or two
+#define SHEET_ID_MAX 64
+
+typedef struct sheet_field {
+  const char *path; // "<section>.<field>", in the sheet's pool
+  const char *expr; // in the pool too, or NULL if the field can't be rolled
+  const char *why; // if expr is NULL, why not
+} sheet_field_t;
+
+typedef struct cached_sheet {
+  char *id; // heap-allocated; NULL marks an empty slot
+  dev_t dev; // identity of the file that was parsed
+  ino_t ino;
+  struct timespec mtime;
+  time_t last_check;
+  uint64_t last_used;
+  sheet_field_t *fields; // heap-allocated
+  size_t field_ct;
+  int *index; // hash index into fields; -1 marks an empty slot
+  size_t index_slots; // always a power of 2
+  char *pool; // heap-allocated
+} cached_sheet_t;
+
+// the cache and use_clock are guarded by cache_lock
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cached_sheet_t cache[CHARSHEET_CACHE_MAX];
+static uint64_t use_clock = 0;
+
+// plain 32-bit FNV-1a
+static unsigned int path_hash(const char *path) {
+  unsigned int h = 2166136261U;
+  for (; *path; path++) {
+    h ^= (unsigned char) *path;
+    h *= 16777619U;
+  }
+  return h;
+}
+
+static void free_sheet(cached_sheet_t *sheet) {
+  free(sheet->id);
+  free(sheet->fields);
+  free(sheet->index);
+  free(sheet->pool);
+  memset(sheet, 0, sizeof(cached_sheet_t));
+}
+
+/**
+ * Writes the dice expression that rolls field into expr and returns
+ * NULL, or returns why the field can't be rolled.
+ */
+static const char *field_expr(const field_t *field, char *expr) {
+  switch (field->type) {
+    case dice_val:
+      if (field->dice_val.dice_ct == INT_MIN || field->dice_val.faces == INT_MIN)
+        return "That field is NULL on the sheet.";
+      snprintf(
+        expr, CHARSHEET_EXPR_MAX,
+        "%dd%d%+d",
+        field->dice_val.dice_ct,
+        field->dice_val.faces,
+        field->dice_val.modifier == INT_MIN ? 0 : field->dice_val.modifier
+      );
+      return NULL;
+    case int_val:
+      if (field->int_val == INT_MIN) return "That field is NULL on the sheet.";
+      snprintf(expr, CHARSHEET_EXPR_MAX, "1d20%+d", field->int_val);
+      return NULL;
+    case stat_val:
+      if (field->stat_val.mod == INT_MIN)
+        return "That field's modifier is NULL on the sheet.";
+      snprintf(expr, CHARSHEET_EXPR_MAX, "1d20%+d", field->stat_val.mod);
+      return NULL;
+    default:
+      return "Only `%dice`, `%int` and `%stat` fields can be rolled.";
+  }
+}
+
+/**
+ * Builds the pool, fields and index of *dest from a parsed sheet.
+ * Returns 0 on success and -1 if out of memory.
+ */
+static int index_sheet(cached_sheet_t *dest, const charsheet_t *charsheet) {
+  size_t field_ct = 0, pool_size = 0;
+  for (size_t i = 0; i < charsheet->section_count; i++) {
+    const section_t *section = charsheet->sections + i;
+    field_ct += section->field_count;
+    for (size_t j = 0; j < section->field_count; j++) {
+      pool_size += strlen(section->identifier) + 1
+                 + strlen(section->fields[j].identifier) + 1
+                 + CHARSHEET_EXPR_MAX;
+    }
+  }
+
+  dest->field_ct = field_ct;
+  dest->index_slots = 1;
+  while (dest->index_slots < 2 * field_ct) dest->index_slots *= 2;
+  dest->fields = calloc(field_ct ? field_ct : 1, sizeof(sheet_field_t));
+  dest->index = malloc(dest->index_slots * sizeof(int));
+  dest->pool = malloc(pool_size ? pool_size : 1);
+  if (!dest->fields || !dest->index || !dest->pool) return -1;
+  memset(dest->index, -1, dest->index_slots * sizeof(int));
+
+  char *pool_pos = dest->pool;
+  size_t n = 0;
+  for (size_t i = 0; i < charsheet->section_count; i++) {
+    const section_t *section = charsheet->sections + i;
+    for (size_t j = 0; j < section->field_count; j++, n++) {
+      sheet_field_t *field = dest->fields + n;
+      field->path = pool_pos;
+      pool_pos += sprintf(
+        pool_pos, "%s.%s",
+        section->identifier, section->fields[j].identifier
+      ) + 1;
+      field->why = field_expr(section->fields + j, pool_pos);
+      if (field->why == NULL) {
+        field->expr = pool_pos;
+        pool_pos += strlen(pool_pos) + 1;
+      }
+
+      size_t slot = path_hash(field->path);
+      while (dest->index[slot & (dest->index_slots - 1)] != -1) slot++;
+      dest->index[slot & (dest->index_slots - 1)] = n;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Loads, lexes, parses and indexes the sheet at path into *dest.
+ * Returns NULL on success or an error message.
+ */
+static const char *load_sheet(
+  cached_sheet_t *dest,
+  const char *sheet_id,
+  char *path
+) {
+  file_view_t file;
+  if (file_cache_acquire(path, &file))
+    return "I couldn't read that character sheet.";
+
+  input_reader_t ir;
+  construct_input_reader(&ir, file.data);
+  lexer_t lex;
+  construct_lexer(&lex, &ir);
+  parser_t parser;
+  construct_parser(&parser, &lex, path);
+  charsheet_t *charsheet = parser.parse(&parser);
+  // the parsed sheet owns copies of everything it needs
+  free(parser.token_vec.tokens);
+  memset(dest, 0, sizeof(cached_sheet_t));
+  // what was actually parsed, which may be newer than what was stat()ed
+  dest->dev = file.dev;
+  dest->ino = file.ino;
+  dest->mtime = file.mtime;
+  file_cache_release(&file);
+  if (charsheet == NULL) {
+    return "That character sheet is malformed; for more info, do `%dnd wtf`.";
+  }
+
+  dest->id = strdup(sheet_id);
+  int failed = dest->id == NULL || index_sheet(dest, charsheet);
+  free_charsheet(charsheet);
+  if (failed) {
+    free_sheet(dest);
+    return "Memory allocation error";
+  }
+  return NULL;
+}
+
+// sheet names are file names in CHARSHEET_DIR, so keep them to one
+static int valid_sheet_id(const char *sheet_id) {
+  size_t len = strlen(sheet_id);
+  if (len == 0 || len > SHEET_ID_MAX || sheet_id[0] == '.') return 0;
+  return strchr(sheet_id, '/') == NULL;
+}
+
+/**
+ * Returns the cached sheet for sheet_id, parsing it if it isn't cached
+ * or has changed since, or NULL with an error message in *err. Must be
+ * called with cache_lock held.
+ */
+static cached_sheet_t *find_sheet_locked(const char *sheet_id, const char **err) {
+  cached_sheet_t *sheet = NULL, *victim = cache;
+  for (size_t i = 0; i < CHARSHEET_CACHE_MAX; i++) {
+    if (cache[i].id != NULL && !strcmp(cache[i].id, sheet_id)) {
+      sheet = cache + i;
+      break;
+    }
+    if (victim->id != NULL
+        && (cache[i].id == NULL || cache[i].last_used < victim->last_used))
+      victim = cache + i;
+  }
+
+  time_t now = time(NULL);
+  if (sheet != NULL && sheet->last_check == now) return sheet;
+
+  char path[sizeof(CHARSHEET_DIR) + SHEET_ID_MAX + sizeof(".dnd")];
+  snprintf(path, sizeof(path), CHARSHEET_DIR "%s.dnd", sheet_id);
+  struct stat st;
+  if (stat(path, &st)) {
+    if (sheet != NULL) free_sheet(sheet);
+    *err = "There's no character sheet by that name.";
+    return NULL;
+  }
+  if (sheet != NULL
+      && st.st_dev == sheet->dev
+      && st.st_ino == sheet->ino
+      && st.st_mtim.tv_sec == sheet->mtime.tv_sec
+      && st.st_mtim.tv_nsec == sheet->mtime.tv_nsec) {
+    sheet->last_check = now;
+    return sheet;
+  }
+
+  // new or changed; a sheet that no longer parses is dropped, not kept stale
+  if (sheet == NULL) sheet = victim;
+  if (sheet->id != NULL) free_sheet(sheet);
+  *err = load_sheet(sheet, sheet_id, path);
+  if (*err != NULL) return NULL;
+  sheet->last_check = now;
+  return sheet;
+}
+
+const char *charsheet_roll_expr(
+  const char *sheet_id,
+  const char *field_path,
+  char *expr
+) {
+  if (!valid_sheet_id(sheet_id)) return "That isn't a character sheet name.";
+
+  const char *err = NULL;
+  pthread_mutex_lock(&cache_lock);
+  cached_sheet_t *sheet = find_sheet_locked(sheet_id, &err);
+  if (sheet != NULL) {
+    sheet->last_used = ++use_clock;
+    err = "That character sheet has no such field.";
+    size_t mask = sheet->index_slots - 1;
+    for (size_t slot = path_hash(field_path); ; slot++) {
+      int i = sheet->index[slot & mask];
+      if (i == -1) break;
+      const sheet_field_t *field = sheet->fields + i;
+      if (!strcmp(field->path, field_path)) {
+        err = field->why;
+        if (field->expr != NULL) strcpy(expr, field->expr);
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return err;
+}
@@ -0,0 +1,39 @@
+#ifndef CHARSHEET_CACHE_H
+#define CHARSHEET_CACHE_H
+
+// same directory dnd_query_charsheet() reads from
+#define CHARSHEET_DIR "charsheets/"
+// most sheets the cache holds at once; the least recently used goes first
+#define CHARSHEET_CACHE_MAX 32
+// room for the dice expression of a rollable field, including the '\0'
+#define CHARSHEET_EXPR_MAX 48
+
+/**
+ * A resident cache of the rollable fields of the character sheets in
+ * CHARSHEET_DIR, for `%roll <sheet> <section>.<field>`. Each sheet is
+ * loaded, lexed and parsed once, and every field is turned into the
+ * dice expression that rolls it and put in a hash index by
+ * "<section>.<field>", so a lookup is a hash probe and a copy. A sheet
+ * is parsed again only when its inode or mtime has changed (checked at
+ * most once per second per sheet).
+ *
+ * What a field rolls:
+ *   %dice[NdF+K]           NdF+K
+ *   %int[K] (skills, etc.) 1d20+K
+ *   %stat[...; mod:K]      1d20+K (an ability check)
+ * Any other field, or one that's NULL, can't be rolled.
+ */
+
+/**
+ * Copies the dice expression for field_path (e.g. "skills.arcana") of
+ * sheet sheet_id into expr, which must have room for CHARSHEET_EXPR_MAX
+ * chars. Returns NULL on success or an error message. Safe to call from
+ * any thread.
+ */
+const char *charsheet_roll_expr(
+  const char *sheet_id,
+  const char *field_path,
+  char *expr
+);
+
+#endif // CHARSHEET_CACHE_H
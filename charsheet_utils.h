@@ -1,12 +1,29 @@
 #ifndef CHARSHEET_UTILS_H
 #define CHARSHEET_UTILS_H
 
-char *dnd_query_charsheet(
+#include "strview.h"
+#include "strbuf.h"
+#include "tryptobot.h"
+
+/**
+ * Appends the reply to `%dnd query` for the given sheet (and section,
+ * and field, either of which may be NULL) to out. Returns -1 if the
+ * sheet couldn't be loaded or parsed and 0 otherwise.
+ */
+int dnd_query_charsheet(
   const char *charsheet_id,
   const char *section_id,
-  const char *field_id
+  const char *field_id,
+  strbuf_t *out
 );
 
-char *cmd_dnd(int margc, char *margv[]);
+// returns -1 if the reply is an error message
+int cmd_dnd(
+  int margc,
+  const strview_t *margv,
+  const char *msg,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
+);
 
 #endif // CHARSHEET_UTILS_H
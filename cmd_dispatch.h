@@ -0,0 +1,22 @@
+// Generated by gen_dispatch.py; do not edit by hand.
+#ifndef CMD_DISPATCH_H
+#define CMD_DISPATCH_H
+
+#define CMD_DISPATCH_SEED 0x00000001U
+#define CMD_DISPATCH_SLOTS 32
+
+static const cmd_entry_t cmd_dispatch_table[CMD_DISPATCH_SLOTS] = {
+  [1] = { "%rollstats", 10, &cmd_rollstats, STAT_ROLLSTATS },
+  [2] = { "%odds", 5, &cmd_odds, STAT_ODDS },
+  [4] = { "%reroll", 7, &cmd_reroll, STAT_REROLL },
+  [8] = { "%cmdinfo", 8, &cmd_cmdinfo, STAT_CMDINFO },
+  [14] = { "%simulate", 9, &cmd_simulate, STAT_SIMULATE },
+  [18] = { "%dnd", 4, &cmd_dnd, STAT_DND },
+  [20] = { "%reverse", 8, &cmd_reverse, STAT_REVERSE },
+  [23] = { "%calcmod", 8, &cmd_calcmod, STAT_CALCMOD },
+  [26] = { "%roll", 5, &cmd_roll, STAT_ROLL },
+  [29] = { "%stats", 6, &cmd_stats, STAT_STATS },
+  [31] = { "%commands", 9, &cmd_commands, STAT_COMMANDS },
+};
+
+#endif // CMD_DISPATCH_H
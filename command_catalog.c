@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "tryptobot.h"
+#include "jsmn.h"
+#include "command_catalog.h"
+#include "file_cache.h"
+
+// the current snapshot; it and last_mtime_check are guarded by catalog_lock
+static pthread_mutex_t catalog_lock = PTHREAD_MUTEX_INITIALIZER;
+static command_catalog_t *catalog = NULL;
+static time_t last_mtime_check = 0;
+
+// number of tokens is stored in *token_ct
+static jsmntok_t *json_tokenize(
+  const char *json_string,
+  size_t json_len,
+  int *token_ct
+) {
+  jsmn_parser p;
+  jsmn_init(&p);
+  *token_ct = jsmn_parse(&p, json_string, json_len, NULL, INT_MAX);
+  if (*token_ct < 1) {
+    fprintf(stderr, "Failed to parse JSON: %d\n", *token_ct);
+    return NULL;
+  }
+  jsmntok_t *tokens = malloc(*token_ct * sizeof(jsmntok_t));
+  jsmn_init(&p); // do not delete this line!
+  *token_ct = jsmn_parse(
+    &p,
+    json_string,
+    json_len,
+    tokens,
+    *token_ct
+  );
+
+  if (*token_ct < 0) {
+    switch (*token_ct) {
+      case JSMN_ERROR_INVAL:
+        fprintf(stderr, "Invalid JSON: %s\n", json_string);
+      break;
+      case JSMN_ERROR_NOMEM:
+        fprintf(stderr, "JSON too large, allocate more memory!\n");
+      break;
+      case JSMN_ERROR_PART:
+        fprintf(stderr, "JSON is too short: %s\n", json_string);
+      break;
+      default:
+        fprintf(stderr, "Failed to parse JSON: %d\n", *token_ct);
+    }
+    free(tokens);
+    return NULL;
+  }
+
+  /* Assume the top-level element is an object */
+  if (*token_ct < 1 || tokens[0].type != JSMN_OBJECT) {
+    fprintf(stderr, "Object expected\n");
+    free(tokens);
+    return NULL;
+  }
+
+  return tokens;
+}
+
+// returns the index of the first token after the one at index i
+static int json_skip(const jsmntok_t *tokens, int i) {
+  int end = i + 1;
+  for (int n = tokens[i].size; n > 0; n--) {
+    end = json_skip(tokens, end);
+  }
+  return end;
+}
+
+static int json_key_is(
+  const char *json_string,
+  const jsmntok_t *token,
+  const char *key
+) {
+  size_t len = token->end - token->start;
+  return token->type == JSMN_STRING
+      && strlen(key) == len
+      && !strncmp(json_string + token->start, key, len);
+}
+
+// plain 32-bit FNV-1a
+static unsigned int name_hash(const char *name) {
+  unsigned int h = 2166136261U;
+  for (; *name; name++) {
+    h ^= (unsigned char) *name;
+    h *= 16777619U;
+  }
+  return h;
+}
+
+static void free_catalog_members(command_catalog_t *c) {
+  free(c->commands);
+  free(c->index);
+  free(c->string_pool);
+  free(c->render_pool);
+}
+
+static const char *const listing_start =
+  "List of commands supported by tryptobot:\n";
+static const char *const listing_end =
+  "For more info about a specific command, try `%cmdinfo <command>`.\n";
+static const char *const info_syntax = "Command syntax: `";
+static const char *const info_description = "`\nCommand description: ";
+
+static char *render_append(char *dest, const char *src) {
+  size_t len = strlen(src);
+  memcpy(dest, src, len);
+  return dest + len;
+}
+
+/**
+ * Renders the `%commands` listing and every `%cmdinfo` reply once, so
+ * answering a help command is just a lookup. Returns 0 on success and
+ * -1 on failure.
+ */
+static int render_catalog(command_catalog_t *c) {
+  size_t listing_len = strlen(listing_start) + strlen(listing_end);
+  size_t render_size = 0;
+  for (size_t i = 0; i < c->size; i++) {
+    listing_len += strlen(c->commands[i].command) + 3; // "`%s`\n"
+    c->commands[i].info_len = strlen(info_syntax)
+                            + strlen(c->commands[i].syntax)
+                            + strlen(info_description)
+                            + strlen(c->commands[i].description);
+    render_size += c->commands[i].info_len + 1;
+  }
+  render_size += listing_len + 1;
+
+  c->render_pool = malloc(render_size);
+  if (c->render_pool == NULL) return -1;
+
+  char *pos = c->render_pool;
+  c->listing = pos;
+  c->listing_len = listing_len;
+  pos = render_append(pos, listing_start);
+  for (size_t i = 0; i < c->size; i++) {
+    *pos++ = '`';
+    pos = render_append(pos, c->commands[i].command);
+    *pos++ = '`';
+    *pos++ = '\n';
+  }
+  pos = render_append(pos, listing_end);
+  *pos++ = '\0';
+
+  for (size_t i = 0; i < c->size; i++) {
+    c->commands[i].info = pos;
+    pos = render_append(pos, info_syntax);
+    pos = render_append(pos, c->commands[i].syntax);
+    pos = render_append(pos, info_description);
+    pos = render_append(pos, c->commands[i].description);
+    *pos++ = '\0';
+  }
+  return 0;
+}
+
+// copies the string token into the pool and returns the copy
+static const char *pool_copy(
+  char **pool_pos,
+  const char *json_string,
+  const jsmntok_t *token
+) {
+  char *result = *pool_pos;
+  size_t len = token->end - token->start;
+  memcpy(result, json_string + token->start, len);
+  result[len] = '\0';
+  *pool_pos += len + 1;
+  return result;
+}
+
+/**
+ * Parses commands.json into *dest. Every string ends up in a single
+ * pool and every rendered reply in another, so a catalog is only five
+ * allocations no matter how many commands it holds. Returns 0 on
+ * success and -1 on failure.
+ */
+static int load_catalog(command_catalog_t *dest) {
+  file_view_t json;
+  if (file_cache_acquire(COMMANDS_JSON_PATH, &json)) {
+    fprintf(stderr, "Unable to find `%s`\n", COMMANDS_JSON_PATH);
+    return -1;
+  }
+  const char *json_string = json.data;
+
+  int token_ct;
+  jsmntok_t *tokens = json_tokenize(json_string, json.len, &token_ct);
+  if (tokens == NULL) {
+    file_cache_release(&json);
+    return -1;
+  }
+
+  // find the "commands" array
+  int array_i = -1;
+  for (int i = 1; i < token_ct; i = json_skip(tokens, i + 1)) {
+    if (json_key_is(json_string, tokens + i, "commands")
+        && tokens[i + 1].type == JSMN_ARRAY) {
+      array_i = i + 1;
+      break;
+    }
+  }
+  if (array_i < 0) {
+    fprintf(stderr, "commands.json has no \"commands\" array\n");
+    free(tokens);
+    file_cache_release(&json);
+    return -1;
+  }
+
+  // first pass: measure the string pool
+  size_t command_ct = tokens[array_i].size;
+  size_t pool_size = 0;
+  int obj_i = array_i + 1;
+  for (size_t n = 0; n < command_ct; n++) {
+    if (tokens[obj_i].type != JSMN_OBJECT) {
+      fprintf(stderr, "commands.json: command %lu is not an object\n", n);
+      free(tokens);
+      file_cache_release(&json);
+      return -1;
+    }
+    pool_size += tokens[obj_i].end - tokens[obj_i].start + 3;
+    obj_i = json_skip(tokens, obj_i);
+  }
+
+  command_catalog_t result = {
+    .commands = calloc(command_ct, sizeof(command_t)),
+    .size = command_ct,
+    .index = NULL,
+    .index_slots = 1,
+    .listing = NULL,
+    .listing_len = 0,
+    .string_pool = malloc(pool_size + 1),
+    .render_pool = NULL,
+    .refcount = 0,
+    .dev = json.dev,
+    .ino = json.ino,
+    .mtime = json.mtime
+  };
+  while (result.index_slots < 2 * command_ct) result.index_slots *= 2;
+  result.index = malloc(result.index_slots * sizeof(int));
+  if (!result.commands || !result.string_pool || !result.index) {
+    fprintf(stderr, "Memory allocation error\n");
+    free_catalog_members(&result);
+    free(tokens);
+    file_cache_release(&json);
+    return -1;
+  }
+  memset(result.index, -1, result.index_slots * sizeof(int));
+
+  // second pass: copy the strings and build the index
+  char *pool_pos = result.string_pool;
+  obj_i = array_i + 1;
+  for (size_t n = 0; n < command_ct; n++) {
+    int key_i = obj_i + 1;
+    for (int k = 0; k < tokens[obj_i].size; k++) {
+      const jsmntok_t *key = tokens + key_i;
+      const jsmntok_t *val = tokens + key_i + 1;
+      if (val->type == JSMN_STRING) {
+        if (json_key_is(json_string, key, "command"))
+          result.commands[n].command = pool_copy(&pool_pos, json_string, val);
+        else if (json_key_is(json_string, key, "syntax"))
+          result.commands[n].syntax = pool_copy(&pool_pos, json_string, val);
+        else if (json_key_is(json_string, key, "description"))
+          result.commands[n].description =
+            pool_copy(&pool_pos, json_string, val);
+      }
+      key_i = json_skip(tokens, key_i);
+    }
+    obj_i = key_i;
+
+    if (result.commands[n].command == NULL
+        || result.commands[n].syntax == NULL
+        || result.commands[n].description == NULL) {
+      fprintf(stderr, "commands.json: command %lu is incomplete\n", n);
+      free_catalog_members(&result);
+      free(tokens);
+      file_cache_release(&json);
+      return -1;
+    }
+
+    size_t slot = name_hash(result.commands[n].command);
+    while (result.index[slot & (result.index_slots - 1)] != -1) slot++;
+    result.index[slot & (result.index_slots - 1)] = n;
+  }
+
+  free(tokens);
+  file_cache_release(&json);
+  if (render_catalog(&result)) {
+    fprintf(stderr, "Memory allocation error\n");
+    free_catalog_members(&result);
+    return -1;
+  }
+  *dest = result;
+  return 0;
+}
+
+// must be called with catalog_lock held
+static void unref_catalog_locked(command_catalog_t *c) {
+  if (--c->refcount == 0) {
+    free_catalog_members(c);
+    free(c);
+  }
+}
+
+// must be called with catalog_lock held
+static int reload_catalog_locked(void) {
+  command_catalog_t *fresh = malloc(sizeof(command_catalog_t));
+  if (fresh == NULL) return -1;
+  if (load_catalog(fresh)) {
+    free(fresh);
+    return -1;
+  }
+  fresh->refcount = 1; // the reference held by `catalog` itself
+  if (catalog != NULL) unref_catalog_locked(catalog);
+  catalog = fresh;
+  return 0;
+}
+
+int reload_command_catalog(void) {
+  pthread_mutex_lock(&catalog_lock);
+  int result = reload_catalog_locked();
+  pthread_mutex_unlock(&catalog_lock);
+  return result;
+}
+
+const command_catalog_t *acquire_command_catalog(void) {
+  pthread_mutex_lock(&catalog_lock);
+  time_t now = time(NULL);
+  if (catalog == NULL) {
+    last_mtime_check = now;
+    reload_catalog_locked();
+  } else if (now != last_mtime_check) {
+    last_mtime_check = now;
+    struct stat st;
+    if (!stat(COMMANDS_JSON_PATH, &st) && (
+      st.st_dev != catalog->dev ||
+      st.st_ino != catalog->ino ||
+      st.st_mtim.tv_sec != catalog->mtime.tv_sec ||
+      st.st_mtim.tv_nsec != catalog->mtime.tv_nsec
+    )) {
+      reload_catalog_locked();
+    }
+  }
+  command_catalog_t *result = catalog;
+  if (result != NULL) result->refcount++;
+  pthread_mutex_unlock(&catalog_lock);
+  return result;
+}
+
+void release_command_catalog(const command_catalog_t *c) {
+  if (c == NULL) return;
+  pthread_mutex_lock(&catalog_lock);
+  unref_catalog_locked((command_catalog_t *) c);
+  pthread_mutex_unlock(&catalog_lock);
+}
+
+const command_t *find_command(
+  const command_catalog_t *catalog,
+  const char *name
+) {
+  size_t mask = catalog->index_slots - 1;
+  for (size_t slot = name_hash(name); ; slot++) {
+    int i = catalog->index[slot & mask];
+    if (i == -1) return NULL;
+    if (!strcmp(catalog->commands[i].command, name))
+      return catalog->commands + i;
+  }
+}
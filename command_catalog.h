@@ -0,0 +1,64 @@
+#ifndef COMMAND_CATALOG_H
+#define COMMAND_CATALOG_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define COMMANDS_JSON_PATH "/home/runner/tryptobot/commands.json"
+
+// the strings point into the owning catalog's string pools
+typedef struct command {
+  const char *command;
+  const char *syntax;
+  const char *description;
+  const char *info; // pre-rendered reply to `%cmdinfo <command>`
+  size_t info_len;
+} command_t;
+
+typedef struct command_catalog {
+  command_t *commands; // heap-allocated, in the order of commands.json
+  size_t size;
+  int *index; // hash index into commands; -1 marks an empty slot
+  size_t index_slots; // always a power of 2
+  const char *listing; // pre-rendered reply to `%commands`
+  size_t listing_len;
+  char *string_pool; // heap-allocated; holds the strings from the JSON
+  char *render_pool; // heap-allocated; holds `listing` and every `info`
+  dev_t dev; // identity of the commands.json that was loaded
+  ino_t ino;
+  struct timespec mtime;
+  size_t refcount; // guarded by command_catalog.c's lock
+} command_catalog_t;
+
+/**
+ * Returns a reference to the resident command catalog, loading it on
+ * the first call. commands.json is re-read only when its inode or mtime
+ * has changed (checked at most once per second) or after
+ * reload_command_catalog(). Returns NULL if no catalog could ever be
+ * loaded. Safe to call from any thread; the returned snapshot stays
+ * valid, even across reloads, until it's passed to
+ * release_command_catalog().
+ */
+const command_catalog_t *acquire_command_catalog(void);
+
+// drops a reference obtained from acquire_command_catalog()
+void release_command_catalog(const command_catalog_t *catalog);
+
+/**
+ * Forces commands.json to be re-read. Returns 0 on success; on failure
+ * the previously loaded catalog (if any) is kept and -1 is returned.
+ */
+int reload_command_catalog(void);
+
+/**
+ * Returns NULL if `name` isn't in the catalog. The returned command's
+ * strings (including the pre-rendered `info`) are borrowed from the
+ * catalog and are immutable, so they can be sent as-is.
+ */
+const command_t *find_command(
+  const command_catalog_t *catalog,
+  const char *name
+);
+
+#endif // COMMAND_CATALOG_H
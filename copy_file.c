@@ -1,25 +1,100 @@
+#define _GNU_SOURCE // copy_file_range() and mkostemp()
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
 #include "copy_file.h"
 
-#define BUF_SIZE 0x10000LU
-static char buf[BUF_SIZE];
+// kept small enough to live on the stack of any thread that calls this
+#define BUF_SIZE 0x4000LU
+// most bytes asked of copy_file_range() or sendfile() at once
+#define CHUNK_SIZE 0x40000000L
 
-int copy_file(const char *src_path, const char *dest_path) {
-  FILE *src, *dst;
-  size_t chars_read_in, chars_written_out;
-  src = fopen(src_path, "rb");
-  if (src == NULL) return -1;
-  dst = fopen(dest_path, "wb+");
-  if (dst < 0) return -1;
-  int result = 0;
-  while (1) {
-    chars_read_in = fread(buf, 1, BUF_SIZE, src);
-    if (chars_read_in == 0) break;
-    result += (chars_written_out =
-      fwrite(buf, 1, chars_read_in, dst));
-    if (chars_written_out == 0) break;
+/**
+ * Whether a failed copy_file_range() or sendfile() just means that this
+ * pair of files doesn't support it (different filesystems, a kernel
+ * without it, ...), so the next method should be tried.
+ */
+static int unsupported(int err) {
+  return err == ENOSYS || err == EXDEV || err == EINVAL
+      || err == EOPNOTSUPP || err == ENOTSUP || err == EPERM;
+}
+
+/**
+ * Copies from the current offset of src to the current offset of dst
+ * until src runs out, adding the bytes copied to *copied. Each method
+ * picks up where the one before it stopped. Returns 0 on success and
+ * -1 on failure.
+ */
+static int copy_data(int src, int dst, ssize_t *copied) {
+  ssize_t n;
+  while ((n = copy_file_range(src, NULL, dst, NULL, CHUNK_SIZE, 0)) > 0)
+    *copied += n;
+  if (n == 0) return 0;
+  if (!unsupported(errno)) return -1;
+
+  while ((n = sendfile(dst, src, NULL, CHUNK_SIZE)) > 0) *copied += n;
+  if (n == 0) return 0;
+  if (!unsupported(errno)) return -1;
+
+  char buf[BUF_SIZE];
+  while ((n = read(src, buf, BUF_SIZE)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    for (ssize_t written = 0; written < n; ) {
+      ssize_t w = write(dst, buf + written, n - written);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      written += w;
+    }
+    *copied += n;
+  }
+  return 0;
+}
+
+ssize_t copy_file(const char *src_path, const char *dest_path) {
+  char tmp_path[PATH_MAX];
+  if (snprintf(tmp_path, PATH_MAX, "%s.XXXXXX", dest_path) >= PATH_MAX)
+    return -1;
+  int src = open(src_path, O_RDONLY | O_CLOEXEC);
+  if (src < 0) return -1;
+  struct stat st;
+  if (fstat(src, &st) || !S_ISREG(st.st_mode)) {
+    close(src);
+    return -1;
+  }
+  int dst = mkostemp(tmp_path, O_CLOEXEC);
+  if (dst < 0) {
+    close(src);
+    return -1;
+  }
+
+  ssize_t copied = 0;
+  int failed = 0;
+  struct stat cloned;
+  if (!ioctl(dst, FICLONE, src) && !fstat(dst, &cloned)) {
+    copied = cloned.st_size;
+  } else {
+    failed = copy_data(src, dst, &copied);
+  }
+  close(src);
+  failed = failed || fchmod(dst, st.st_mode & 07777);
+  // get the data to the disk before the rename makes it dest_path
+  failed = failed || fsync(dst);
+  failed = close(dst) || failed;
+  if (failed || rename(tmp_path, dest_path)) {
+    unlink(tmp_path);
+    return -1;
   }
-  fclose(src);
-  fclose(dst);
-  return result;
+  return copied;
 }
@@ -1,6 +1,23 @@
 #ifndef COPY_FILE_H
 #define COPY_FILE_H
 
-int copy_file(const char *src_path, const char *dest_path);
+#include <sys/types.h>
+
+/**
+ * Copies the file at src_path to dest_path and returns the number of
+ * bytes copied, or -1 on failure. The copy is written to a temporary
+ * file next to dest_path, synced to the disk and renamed over it, so
+ * dest_path is always either the old file or the complete copy, never
+ * a partial one, and the temporary file is removed if anything fails;
+ * the copy gets src_path's permissions.
+ *
+ * The data is copied in the kernel wherever possible. The first thing
+ * tried is a reflink (ioctl FICLONE), which on filesystems that support
+ * it (btrfs, XFS, ...) shares the source's blocks instead of copying
+ * them. Then copy_file_range(2), then sendfile(2), and finally plain
+ * read(2)/write(2) through a buffer on the stack. Allocates no memory
+ * and is safe to call from any thread.
+ */
+ssize_t copy_file(const char *src_path, const char *dest_path);
 
 #endif
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include "dice.h"
+
+static uint64_t splitmix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+void dice_rng_seed(dice_rng_t *rng, uint64_t seed) {
+  // splitmix64 never yields four zeros in a row, so the state is valid
+  for (int i = 0; i < 4; i++) rng->s[i] = splitmix64(&seed);
+}
+
+void dice_rng_seed_from_os(dice_rng_t *rng) {
+  uint64_t seed;
+  if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed)) {
+    // no entropy source; mix in enough to keep threads and processes apart
+    fprintf(stderr, "getrandom() failed; seeding dice from the clock\n");
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    seed = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    seed ^= (uint64_t) getpid() << 32;
+    seed ^= (uint64_t) (uintptr_t) rng;
+  }
+  dice_rng_seed(rng, seed);
+}
+
+static inline uint64_t rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+uint64_t dice_rng_next(dice_rng_t *rng) {
+  uint64_t *s = rng->s;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+  return result;
+}
+
+void dice_rng_jump(dice_rng_t *rng) {
+  static const uint64_t jump[4] = {
+    0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL,
+    0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL
+  };
+  uint64_t s[4] = { 0, 0, 0, 0 };
+  for (int i = 0; i < 4; i++) {
+    for (int bit = 0; bit < 64; bit++) {
+      if (jump[i] & (1ULL << bit)) {
+        for (int j = 0; j < 4; j++) s[j] ^= rng->s[j];
+      }
+      dice_rng_next(rng);
+    }
+  }
+  for (int j = 0; j < 4; j++) rng->s[j] = s[j];
+}
+
+uint32_t dice_rng_bounded(dice_rng_t *rng, uint32_t range) {
+  uint64_t m = (dice_rng_next(rng) >> 32) * range;
+  uint32_t low = (uint32_t) m;
+  if (low < range) {
+    // reject the few draws that would make some values more likely
+    uint32_t threshold = -range % range;
+    while (low < threshold) {
+      m = (dice_rng_next(rng) >> 32) * range;
+      low = (uint32_t) m;
+    }
+  }
+  return m >> 32;
+}
+
+static _Thread_local dice_rng_t thread_rng;
+static _Thread_local int thread_rng_seeded = 0;
+
+dice_rng_t *dice_thread_rng(void) {
+  if (!thread_rng_seeded) {
+    dice_rng_seed_from_os(&thread_rng);
+    thread_rng_seeded = 1;
+  }
+  return &thread_rng;
+}
+
+double dice_rng_double(dice_rng_t *rng) {
+  return (dice_rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+// a standard normal deviate (Box-Muller)
+static double dice_rng_normal(dice_rng_t *rng) {
+  double u1 = 1.0 - dice_rng_double(rng); // in (0, 1], so log() is finite
+  double u2 = dice_rng_double(rng);
+  return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+long long dice_sum(dice_rng_t *rng, int dice_ct, int faces) {
+  if (dice_ct <= 0 || faces <= 0) return 0;
+  if (faces == 1) return dice_ct;
+  if (dice_ct <= DICE_EXACT_MAX) {
+    uint32_t rolls[DICE_EXACT_MAX];
+    dice_fill(rng, rolls, dice_ct, faces);
+    return dice_reduce(rolls, dice_ct, DICE_REDUCE_SUM, 0);
+  }
+
+  // one die has mean (f + 1) / 2 and variance (f^2 - 1) / 12
+  double f = faces;
+  double mean = dice_ct * (f + 1.0) / 2.0;
+  double sd = sqrt(dice_ct * (f * f - 1.0) / 12.0);
+  double total = round(mean + sd * dice_rng_normal(rng));
+  double lowest = dice_ct;
+  double highest = (double) dice_ct * faces;
+  if (total < lowest) total = lowest;
+  if (total > highest) total = highest;
+  return (long long) total;
+}
@@ -1,8 +1,107 @@
 #ifndef DICE_H
 #define DICE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+// longest dice expression that can be rolled, including the '\0'
+#define DICE_EXPR_MAX 64
+// most dice terms whose subtotals a diceroll_t keeps
+#define DICE_TERMS_MAX 8
+
+typedef struct dice_term_total {
+  uint8_t label_start, label_len; // the term's place in the roll's expr
+  long long value;
+} dice_term_total_t;
+
 typedef struct diceroll {
-  int dice_ct, faces, modifier, value;
+  // a single NdM+K roll, as stored in character sheets
+  int dice_ct, faces, modifier;
+  long long value;
+  // the expression that was rolled (see dice_expr.h), or "" if none
+  char expr[DICE_EXPR_MAX];
+  int term_ct; // number of dice terms, which may exceed DICE_TERMS_MAX
+  dice_term_total_t terms[DICE_TERMS_MAX];
 } diceroll_t;
 
+/**
+ * State of a xoshiro256** generator. Any state other than all zeros
+ * is valid; dice_rng_seed() takes care of that.
+ */
+typedef struct dice_rng {
+  uint64_t s[4];
+} dice_rng_t;
+
+// expands a 64-bit seed into a full generator state (with splitmix64)
+void dice_rng_seed(dice_rng_t *rng, uint64_t seed);
+
+// seeds rng from the OS's entropy source
+void dice_rng_seed_from_os(dice_rng_t *rng);
+
+uint64_t dice_rng_next(dice_rng_t *rng);
+
+/**
+ * Advances rng by 2^128 draws, as if dice_rng_next() had been called
+ * that many times. Jumping a copy of a generator k times gives the
+ * k-th of 2^128 streams that never overlap, e.g. one per thread.
+ */
+void dice_rng_jump(dice_rng_t *rng);
+
+/**
+ * Returns a uniformly distributed value in [0, range) without modulo
+ * bias (Lemire's multiply-shift method, which almost never needs a
+ * second draw). range must not be 0.
+ */
+uint32_t dice_rng_bounded(dice_rng_t *rng, uint32_t range);
+
+/**
+ * Returns this thread's generator, seeding it from the OS the first
+ * time the thread asks for it. Threads never share state, so rolling
+ * takes no locks.
+ */
+dice_rng_t *dice_thread_rng(void);
+
+/**
+ * Fills out[0] through out[n-1] with rolls of a die with the given
+ * number of faces (each in [1, faces]). Long buffers are filled by an
+ * AVX2 or SSE2 kernel, picked at runtime, that runs several
+ * xoshiro256** streams side by side; they're seeded from rng, so the
+ * rolls only depend on rng's state.
+ */
+void dice_fill(dice_rng_t *rng, uint32_t *out, size_t n, uint32_t faces);
+
+typedef enum dice_reduce {
+  DICE_REDUCE_SUM,
+  DICE_REDUCE_MIN,
+  DICE_REDUCE_MAX,
+  DICE_REDUCE_KEEP_HIGHEST, // sum of the `keep` highest rolls
+  DICE_REDUCE_KEEP_LOWEST // sum of the `keep` lowest rolls
+} dice_reduce_t;
+
+/**
+ * Reduces n rolls (as filled by dice_fill()) to one value. `keep` is
+ * only used by the keep-highest/lowest ops. Returns 0 if n is 0, or
+ * -1 if keep-highest/lowest ran out of memory.
+ */
+long long dice_reduce(
+  const uint32_t *rolls,
+  size_t n,
+  dice_reduce_t op,
+  size_t keep
+);
+
+// uniformly distributed in [0, 1), with 53 random bits
+double dice_rng_double(dice_rng_t *rng);
+
+/**
+ * Returns the total of dice_ct dice with the given number of faces.
+ * Up to DICE_EXACT_MAX dice are each rolled; past that, the total is
+ * drawn from the normal distribution with the same mean and variance
+ * (clamped to the possible totals), which takes the same time no
+ * matter how many dice there are and is indistinguishable from
+ * rolling them at that size.
+ */
+#define DICE_EXACT_MAX 4096
+long long dice_sum(dice_rng_t *rng, int dice_ct, int faces);
+
 #endif // DICE_H
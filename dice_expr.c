@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include "dice.h"
+#include "dice_expr.h"
+
+// most times one die explodes before the chain is cut off
+#define DICE_EXPLODE_MAX 100
+
+typedef struct compiler {
+  const char *pos; // next char of program->text to read
+  dice_program_t *program;
+  int depth; // current depth of the evaluation stack
+  const char *err;
+} compiler_t;
+
+static int emit(compiler_t *c, uint8_t op, int operand, int depth_change) {
+  dice_program_t *p = c->program;
+  if (p->code_len + 2 > sizeof(p->code)) {
+    c->err = "Dice expression is too complex.";
+    return -1;
+  }
+  p->code[p->code_len++] = op;
+  if (operand >= 0) p->code[p->code_len++] = operand;
+  c->depth += depth_change;
+  if (c->depth > p->max_depth) p->max_depth = c->depth;
+  return 0;
+}
+
+static int parse_number(compiler_t *c, int *dest) {
+  if (!isdigit((unsigned char) *c->pos)) {
+    c->err = "Expected a number in dice expression.";
+    return -1;
+  }
+  long long value = 0;
+  while (isdigit((unsigned char) *c->pos)) {
+    value = value * 10 + (*c->pos++ - '0');
+    if (value > INT_MAX) {
+      c->err = "Numbers in dice expressions must be at most 2147483647.";
+      return -1;
+    }
+  }
+  *dest = value;
+  return 0;
+}
+
+// parses what follows `d<faces>`: kh/kl/k/dh/dl with an optional count, and !
+static int parse_dice_modifiers(compiler_t *c, dice_term_t *term) {
+  int has_keep = 0;
+  while (1) {
+    int drop = 0;
+    if (*c->pos == '!') {
+      if (term->explode) {
+        c->err = "A dice term can only explode once.";
+        return -1;
+      }
+      term->explode = 1;
+      c->pos++;
+      continue;
+    } else if (*c->pos == 'k') {
+      c->pos++;
+    } else if (*c->pos == 'd' && (c->pos[1] == 'h' || c->pos[1] == 'l')) {
+      drop = 1;
+      c->pos++;
+    } else {
+      return 0;
+    }
+
+    if (has_keep) {
+      c->err = "A dice term can only keep or drop once.";
+      return -1;
+    }
+    has_keep = 1;
+    int highest = 1;
+    if (*c->pos == 'h') {
+      c->pos++;
+    } else if (*c->pos == 'l') {
+      highest = 0;
+      c->pos++;
+    }
+    int n = 1;
+    if (isdigit((unsigned char) *c->pos) && parse_number(c, &n)) return -1;
+
+    if (n > term->count) n = term->count;
+    if (drop) {
+      // dropping the n highest is keeping the rest, which are the lowest
+      highest = !highest;
+      n = term->count - n;
+    }
+    term->keep_mode = highest ? DICE_KEEP_HIGHEST : DICE_KEEP_LOWEST;
+    term->keep = n;
+  }
+}
+
+static int parse_dice_term(compiler_t *c, int count, const char *start) {
+  dice_program_t *p = c->program;
+  if (p->term_ct == sizeof(p->terms) / sizeof(p->terms[0])) {
+    c->err = "Dice expression has too many terms.";
+    return -1;
+  }
+  dice_term_t term = { .count = count, .keep_mode = DICE_KEEP_ALL };
+  c->pos++; // 'd'
+  if (parse_number(c, &term.faces)) return -1;
+  if (term.faces < 1) {
+    c->err = "Dice must have at least one face.";
+    return -1;
+  }
+  if (parse_dice_modifiers(c, &term)) return -1;
+  if (term.explode && term.faces == 1) {
+    c->err = "A d1 would explode forever.";
+    return -1;
+  }
+  if ((term.explode || term.keep_mode != DICE_KEEP_ALL)
+      && term.count > DICE_EXACT_MAX) {
+    c->err = "Only up to 4096 dice can be kept, dropped, or exploded.";
+    return -1;
+  }
+  term.label_start = start - p->text;
+  term.label_len = c->pos - start;
+  p->terms[p->term_ct] = term;
+  return emit(c, DICE_OP_DICE, p->term_ct++, 1);
+}
+
+static int parse_expr(compiler_t *c);
+
+static int parse_primary(compiler_t *c) {
+  dice_program_t *p = c->program;
+  const char *start = c->pos;
+  if (*c->pos == '(') {
+    c->pos++;
+    if (parse_expr(c)) return -1;
+    if (*c->pos != ')') {
+      c->err = "Missing `)` in dice expression.";
+      return -1;
+    }
+    c->pos++;
+    return 0;
+  }
+  if (*c->pos == 'd') return parse_dice_term(c, 1, start);
+
+  int n;
+  if (parse_number(c, &n)) return -1;
+  if (*c->pos == 'd') return parse_dice_term(c, n, start);
+  p->consts[p->const_ct] = n;
+  return emit(c, DICE_OP_CONST, p->const_ct++, 1);
+}
+
+static int parse_unary(compiler_t *c) {
+  if (*c->pos == '-') {
+    c->pos++;
+    if (parse_unary(c)) return -1;
+    return emit(c, DICE_OP_NEG, -1, 0);
+  }
+  return parse_primary(c);
+}
+
+static int parse_product(compiler_t *c) {
+  if (parse_unary(c)) return -1;
+  while (*c->pos == '*') {
+    c->pos++;
+    if (parse_unary(c)) return -1;
+    if (emit(c, DICE_OP_MUL, -1, -1)) return -1;
+  }
+  return 0;
+}
+
+static int parse_expr(compiler_t *c) {
+  if (parse_product(c)) return -1;
+  while (*c->pos == '+' || *c->pos == '-') {
+    uint8_t op = *c->pos++ == '+' ? DICE_OP_ADD : DICE_OP_SUB;
+    if (parse_product(c)) return -1;
+    if (emit(c, op, -1, -1)) return -1;
+  }
+  return 0;
+}
+
+const char *dice_expr_compile(const char *text, dice_program_t *program) {
+  size_t len = strlen(text);
+  if (len == 0) return "Empty dice expression.";
+  if (len >= DICE_EXPR_MAX) return "Dice expression is too long.";
+  memset(program, 0, sizeof(dice_program_t));
+  for (size_t i = 0; i <= len; i++) program->text[i] = tolower(text[i]);
+
+  compiler_t c = { program->text, program, 0, NULL };
+  if (parse_expr(&c)) return c.err;
+  if (*c.pos != '\0') return "Unexpected character in dice expression.";
+  return NULL;
+}
+
+static int compare_ll(const void *a, const void *b) {
+  long long x = *(const long long *) a;
+  long long y = *(const long long *) b;
+  return (x > y) - (x < y);
+}
+
+// rolls every die on its own, for terms that keep/drop or explode
+static long long eval_each_die(const dice_term_t *term, dice_rng_t *rng) {
+  uint32_t rolls[DICE_EXACT_MAX];
+  dice_fill(rng, rolls, term->count, term->faces);
+  if (!term->explode) {
+    dice_reduce_t op = term->keep_mode == DICE_KEEP_HIGHEST ?
+                       DICE_REDUCE_KEEP_HIGHEST : DICE_REDUCE_KEEP_LOWEST;
+    return dice_reduce(rolls, term->count, op, term->keep);
+  }
+
+  long long values[DICE_EXACT_MAX];
+  for (int i = 0; i < term->count; i++) {
+    uint32_t roll = rolls[i];
+    values[i] = roll;
+    for (int chain = 0; roll == (uint32_t) term->faces
+         && chain < DICE_EXPLODE_MAX; chain++) {
+      roll = dice_rng_bounded(rng, term->faces) + 1;
+      values[i] += roll;
+    }
+  }
+  int first = 0, last = term->count;
+  if (term->keep_mode != DICE_KEEP_ALL) {
+    qsort(values, term->count, sizeof(long long), compare_ll);
+    if (term->keep_mode == DICE_KEEP_HIGHEST) first = term->count - term->keep;
+    else last = term->keep;
+  }
+  long long total = 0;
+  for (int i = first; i < last; i++) total += values[i];
+  return total;
+}
+
+const char *dice_program_eval(
+  const dice_program_t *program,
+  dice_rng_t *rng,
+  diceroll_t *result
+) {
+  return dice_program_eval_terms(program, rng, result, NULL);
+}
+
+const char *dice_program_eval_terms(
+  const dice_program_t *program,
+  dice_rng_t *rng,
+  diceroll_t *result,
+  long long *term_values
+) {
+  long long stack[DICE_EXPR_MAX];
+  int top = 0;
+  memset(result, 0, sizeof(diceroll_t));
+  memcpy(result->expr, program->text, DICE_EXPR_MAX);
+
+  for (int pc = 0; pc < program->code_len; ) {
+    long long a, b;
+    switch (program->code[pc++]) {
+      case DICE_OP_CONST:
+        stack[top++] = program->consts[program->code[pc++]];
+      break;
+      case DICE_OP_DICE: {
+        uint8_t index = program->code[pc++];
+        const dice_term_t *term = program->terms + index;
+        long long value;
+        if (term->explode || term->keep_mode != DICE_KEEP_ALL) {
+          value = eval_each_die(term, rng);
+          if (value < 0) return "Memory allocation error";
+        } else {
+          value = dice_sum(rng, term->count, term->faces);
+        }
+        if (result->term_ct < DICE_TERMS_MAX) {
+          result->terms[result->term_ct] = (dice_term_total_t){
+            .label_start = term->label_start,
+            .label_len = term->label_len,
+            .value = value
+          };
+        }
+        result->term_ct++;
+        if (term_values != NULL) term_values[index] = value;
+        stack[top++] = value;
+      }
+      break;
+      case DICE_OP_ADD:
+        b = stack[--top];
+        a = stack[--top];
+        if (__builtin_add_overflow(a, b, stack + top++))
+          return "The result of that roll is too big.";
+      break;
+      case DICE_OP_SUB:
+        b = stack[--top];
+        a = stack[--top];
+        if (__builtin_sub_overflow(a, b, stack + top++))
+          return "The result of that roll is too big.";
+      break;
+      case DICE_OP_MUL:
+        b = stack[--top];
+        a = stack[--top];
+        if (__builtin_mul_overflow(a, b, stack + top++))
+          return "The result of that roll is too big.";
+      break;
+      case DICE_OP_NEG:
+        if (__builtin_sub_overflow(0, stack[top - 1], stack + top - 1))
+          return "The result of that roll is too big.";
+      break;
+      default:
+        return "Backend error: corrupt dice program";
+    }
+  }
+  result->value = stack[0];
+  return NULL;
+}
+
+/**
+ * Each thread keeps the programs for the last few distinct
+ * expressions it rolled, so repeating a roll skips the compiler.
+ */
+#define DICE_CACHE_SLOTS 16
+
+typedef struct dice_cache_entry {
+  int valid;
+  dice_program_t program; // program.text is the key
+} dice_cache_entry_t;
+
+static _Thread_local dice_cache_entry_t dice_cache[DICE_CACHE_SLOTS];
+
+const dice_program_t *dice_expr_compile_cached(
+  const char *text,
+  const char **err
+) {
+  char key[DICE_EXPR_MAX];
+  size_t len = strlen(text);
+  if (len >= DICE_EXPR_MAX) {
+    *err = "Dice expression is too long.";
+    return NULL;
+  }
+  unsigned int h = 2166136261U;
+  for (size_t i = 0; i <= len; i++) {
+    key[i] = tolower(text[i]);
+    h = (h ^ (unsigned char) key[i]) * 16777619U;
+  }
+
+  dice_cache_entry_t *entry = dice_cache + (h & (DICE_CACHE_SLOTS - 1));
+  if (entry->valid && !strcmp(entry->program.text, key)) return &entry->program;
+  entry->valid = 0;
+  *err = dice_expr_compile(key, &entry->program);
+  if (*err != NULL) return NULL;
+  entry->valid = 1;
+  return &entry->program;
+}
+
+const char *roll_dice_expr(const char *text, diceroll_t *result) {
+  const char *err = NULL;
+  const dice_program_t *program = dice_expr_compile_cached(text, &err);
+  if (program == NULL) return err;
+  return dice_program_eval(program, dice_thread_rng(), result);
+}
@@ -0,0 +1,102 @@
+#ifndef DICE_EXPR_H
+#define DICE_EXPR_H
+
+#include <stdint.h>
+#include "dice.h"
+
+/**
+ * Dice expressions, e.g. `4d6kh3`, `2d20kl1`, `1d6!` or
+ * `(3d8+2d6-1)*2`. A dice term is [count]d<faces> followed by any of
+ * kh<n>/k<n> (keep the n highest), kl<n> (keep the n lowest),
+ * dh<n>/dl<n> (drop the n highest/lowest) and `!` (every die that
+ * rolls its highest face is rolled again and added). Terms and
+ * integers combine with + - * and parentheses. Case doesn't matter.
+ * An expression is compiled once into postfix bytecode for a small
+ * stack machine, then evaluated as often as needed.
+ */
+
+enum dice_op {
+  DICE_OP_CONST, // operand: index into consts
+  DICE_OP_DICE, // operand: index into terms
+  DICE_OP_ADD,
+  DICE_OP_SUB,
+  DICE_OP_MUL,
+  DICE_OP_NEG
+};
+
+enum dice_keep {
+  DICE_KEEP_ALL,
+  DICE_KEEP_HIGHEST,
+  DICE_KEEP_LOWEST
+};
+
+typedef struct dice_term {
+  int count, faces;
+  int keep; // how many dice are kept, unless keep_mode is DICE_KEEP_ALL
+  uint8_t keep_mode;
+  uint8_t explode;
+  uint8_t label_start, label_len; // where the term is in the program's text
+} dice_term_t;
+
+// most dice terms one program can have
+#define DICE_PROGRAM_TERMS_MAX (DICE_EXPR_MAX / 2)
+
+typedef struct dice_program {
+  char text[DICE_EXPR_MAX]; // the normalized (lowercase) source
+  uint8_t code[2 * DICE_EXPR_MAX];
+  uint8_t code_len;
+  uint8_t const_ct;
+  uint8_t term_ct;
+  uint8_t max_depth; // deepest the evaluation stack gets
+  long long consts[DICE_EXPR_MAX];
+  dice_term_t terms[DICE_PROGRAM_TERMS_MAX];
+} dice_program_t;
+
+/**
+ * Compiles text into *program. Returns NULL on success, or an error
+ * message (a string literal) describing what's wrong with text.
+ */
+const char *dice_expr_compile(const char *text, dice_program_t *program);
+
+/**
+ * Like dice_expr_compile(), but returns this thread's cached program
+ * for text if it has one, and caches the program otherwise. The
+ * result stays valid until this thread compiles another expression.
+ * On failure, returns NULL and stores an error message in *err.
+ */
+const dice_program_t *dice_expr_compile_cached(
+  const char *text,
+  const char **err
+);
+
+/**
+ * Runs program with rng and stores the total, the text, and the
+ * subtotal of each dice term in *result. Returns NULL on success or
+ * an error message (a string literal), e.g. if the total overflows.
+ */
+const char *dice_program_eval(
+  const dice_program_t *program,
+  dice_rng_t *rng,
+  diceroll_t *result
+);
+
+/**
+ * Like dice_program_eval(), but also stores the subtotal of every dice
+ * term, including any past the DICE_TERMS_MAX that *result keeps, in
+ * term_values[i] for program->terms[i].
+ */
+const char *dice_program_eval_terms(
+  const dice_program_t *program,
+  dice_rng_t *rng,
+  diceroll_t *result,
+  long long *term_values
+);
+
+/**
+ * Compiles (or takes from this thread's compile cache) and rolls
+ * text on this thread's rng. Returns NULL on success or an error
+ * message (a string literal).
+ */
+const char *roll_dice_expr(const char *text, diceroll_t *result);
+
+#endif // DICE_EXPR_H
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "dice.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DICE_KERNEL_X86 1
+#endif
+
+/**
+ * The vector kernels run one xoshiro256** stream per lane, so each
+ * call first seeds the lanes from the caller's generator. That costs
+ * a few dozen draws, which only pays off for longer buffers.
+ */
+#define DICE_VECTOR_MIN 64
+
+// the same lane-seeding for every kernel, so results only depend on rng
+static void seed_lanes(dice_rng_t *rng, uint64_t (*lanes)[4], int lane_ct) {
+  for (int lane = 0; lane < lane_ct; lane++) {
+    dice_rng_t lane_rng;
+    dice_rng_seed(&lane_rng, dice_rng_next(rng));
+    for (int word = 0; word < 4; word++) lanes[word][lane] = lane_rng.s[word];
+  }
+}
+
+static void fill_scalar(
+  dice_rng_t *rng,
+  uint32_t *out,
+  size_t n,
+  uint32_t faces
+) {
+  for (size_t i = 0; i < n; i++) out[i] = dice_rng_bounded(rng, faces) + 1;
+}
+
+#ifdef DICE_KERNEL_X86
+
+__attribute__((target("avx2")))
+static inline __m256i rotl_avx2(__m256i x, int k) {
+  return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k));
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(dice_rng_t *rng, uint32_t *out, size_t n, uint32_t faces) {
+  uint64_t lanes[4][4];
+  seed_lanes(rng, lanes, 4);
+  __m256i s0 = _mm256_loadu_si256((const __m256i *) lanes[0]);
+  __m256i s1 = _mm256_loadu_si256((const __m256i *) lanes[1]);
+  __m256i s2 = _mm256_loadu_si256((const __m256i *) lanes[2]);
+  __m256i s3 = _mm256_loadu_si256((const __m256i *) lanes[3]);
+  const __m256i range = _mm256_set1_epi64x(faces);
+  const __m256i threshold = _mm256_set1_epi64x((uint32_t) -faces % faces);
+  const __m256i low_mask = _mm256_set1_epi64x(0xFFFFFFFFULL);
+  const __m256i one = _mm256_set1_epi32(1);
+  // moves the high dword of each 64-bit lane into the low 128 bits
+  const __m256i gather_high = _mm256_setr_epi32(1, 3, 5, 7, 0, 0, 0, 0);
+
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    // xoshiro256**, with the multiplications done as shifts and adds
+    __m256i x = _mm256_add_epi64(_mm256_slli_epi64(s1, 2), s1); // s1 * 5
+    x = rotl_avx2(x, 7);
+    x = _mm256_add_epi64(_mm256_slli_epi64(x, 3), x); // x * 9
+    __m256i t = _mm256_slli_epi64(s1, 17);
+    s2 = _mm256_xor_si256(s2, s0);
+    s3 = _mm256_xor_si256(s3, s1);
+    s1 = _mm256_xor_si256(s1, s2);
+    s0 = _mm256_xor_si256(s0, s3);
+    s2 = _mm256_xor_si256(s2, t);
+    s3 = rotl_avx2(s3, 45);
+
+    // Lemire: the high half of (32 random bits * faces) is the roll
+    __m256i m = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), range);
+    __m256i rolls = _mm256_permutevar8x32_epi32(m, gather_high);
+    _mm_storeu_si128(
+      (__m128i *) (out + i),
+      _mm256_castsi256_si128(_mm256_add_epi32(rolls, one))
+    );
+
+    __m256i rejected = _mm256_cmpgt_epi64(
+      threshold, _mm256_and_si256(m, low_mask)
+    );
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(rejected));
+    while (mask) {
+      // biased draw; replace it with an independent unbiased one
+      int lane = __builtin_ctz(mask);
+      out[i + lane] = dice_rng_bounded(rng, faces) + 1;
+      mask &= mask - 1;
+    }
+  }
+  fill_scalar(rng, out + i, n - i, faces);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i rotl_sse2(__m128i x, int k) {
+  return _mm_or_si128(_mm_slli_epi64(x, k), _mm_srli_epi64(x, 64 - k));
+}
+
+__attribute__((target("sse2")))
+static void fill_sse2(dice_rng_t *rng, uint32_t *out, size_t n, uint32_t faces) {
+  uint64_t lanes[4][4];
+  seed_lanes(rng, lanes, 2);
+  __m128i s0 = _mm_loadu_si128((const __m128i *) lanes[0]);
+  __m128i s1 = _mm_loadu_si128((const __m128i *) lanes[1]);
+  __m128i s2 = _mm_loadu_si128((const __m128i *) lanes[2]);
+  __m128i s3 = _mm_loadu_si128((const __m128i *) lanes[3]);
+  const __m128i range = _mm_set1_epi64x(faces);
+  // SSE2 only compares signed dwords, so both sides are offset by 2^31
+  const __m128i bias = _mm_set1_epi32(0x80000000);
+  const __m128i threshold = _mm_xor_si128(
+    _mm_set1_epi32((uint32_t) -faces % faces), bias
+  );
+  const __m128i one = _mm_set1_epi32(1);
+
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i x = _mm_add_epi64(_mm_slli_epi64(s1, 2), s1);
+    x = rotl_sse2(x, 7);
+    x = _mm_add_epi64(_mm_slli_epi64(x, 3), x);
+    __m128i t = _mm_slli_epi64(s1, 17);
+    s2 = _mm_xor_si128(s2, s0);
+    s3 = _mm_xor_si128(s3, s1);
+    s1 = _mm_xor_si128(s1, s2);
+    s0 = _mm_xor_si128(s0, s3);
+    s2 = _mm_xor_si128(s2, t);
+    s3 = rotl_sse2(s3, 45);
+
+    __m128i m = _mm_mul_epu32(_mm_srli_epi64(x, 32), range);
+    __m128i rolls = _mm_shuffle_epi32(m, _MM_SHUFFLE(3, 1, 3, 1));
+    _mm_storel_epi64((__m128i *) (out + i), _mm_add_epi32(rolls, one));
+
+    // only dwords 0 and 2 (the low halves of the products) matter
+    __m128i rejected = _mm_cmplt_epi32(_mm_xor_si128(m, bias), threshold);
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(rejected)) & 0x5;
+    if (mask & 0x1) out[i] = dice_rng_bounded(rng, faces) + 1;
+    if (mask & 0x4) out[i + 1] = dice_rng_bounded(rng, faces) + 1;
+  }
+  fill_scalar(rng, out + i, n - i, faces);
+}
+
+#endif // DICE_KERNEL_X86
+
+typedef void (*fill_fn_t)(dice_rng_t *, uint32_t *, size_t, uint32_t);
+
+// set once, by the first dice_fill() on any thread, to the widest
+// kernel this CPU supports
+static pthread_once_t fill_once = PTHREAD_ONCE_INIT;
+static fill_fn_t fill = NULL;
+
+static void resolve_fill(void) {
+#ifdef DICE_KERNEL_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) fill = fill_avx2;
+  else if (__builtin_cpu_supports("sse2")) fill = fill_sse2;
+  else fill = fill_scalar;
+#else
+  fill = fill_scalar;
+#endif
+}
+
+void dice_fill(dice_rng_t *rng, uint32_t *out, size_t n, uint32_t faces) {
+  if (faces == 0 || n == 0) return;
+  if (n < DICE_VECTOR_MIN) {
+    fill_scalar(rng, out, n, faces);
+  } else {
+    pthread_once(&fill_once, resolve_fill);
+    fill(rng, out, n, faces);
+  }
+}
+
+// above this many faces, keep-highest/lowest sorts instead of counting
+#define DICE_COUNTING_MAX_FACES 1024
+
+static int compare_uint32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+// sum of the `keep` highest (or lowest) of n rolls
+static long long reduce_keep(
+  const uint32_t *rolls,
+  size_t n,
+  size_t keep,
+  int highest
+) {
+  if (keep >= n) keep = n;
+  uint32_t max_roll = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (rolls[i] > max_roll) max_roll = rolls[i];
+  }
+
+  long long total = 0;
+  if (max_roll <= DICE_COUNTING_MAX_FACES) {
+    // only clear the counts that can be used; this runs once per roll
+    uint32_t counts[DICE_COUNTING_MAX_FACES + 1];
+    memset(counts, 0, (max_roll + 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) counts[rolls[i]]++;
+    for (uint32_t k = 0; k <= max_roll && keep > 0; k++) {
+      uint32_t face = highest ? max_roll - k : k;
+      size_t taken = counts[face] < keep ? counts[face] : keep;
+      total += (long long) taken * face;
+      keep -= taken;
+    }
+    return total;
+  }
+
+  uint32_t *sorted = malloc(n * sizeof(uint32_t));
+  if (sorted == NULL) return -1;
+  memcpy(sorted, rolls, n * sizeof(uint32_t));
+  qsort(sorted, n, sizeof(uint32_t), compare_uint32);
+  for (size_t i = 0; i < keep; i++) {
+    total += highest ? sorted[n - 1 - i] : sorted[i];
+  }
+  free(sorted);
+  return total;
+}
+
+long long dice_reduce(
+  const uint32_t *rolls,
+  size_t n,
+  dice_reduce_t op,
+  size_t keep
+) {
+  if (n == 0) return 0;
+  long long result;
+  switch (op) {
+    case DICE_REDUCE_MIN:
+      result = rolls[0];
+      for (size_t i = 1; i < n; i++) {
+        if (rolls[i] < result) result = rolls[i];
+      }
+      return result;
+    case DICE_REDUCE_MAX:
+      result = rolls[0];
+      for (size_t i = 1; i < n; i++) {
+        if (rolls[i] > result) result = rolls[i];
+      }
+      return result;
+    case DICE_REDUCE_KEEP_HIGHEST:
+      return reduce_keep(rolls, n, keep, 1);
+    case DICE_REDUCE_KEEP_LOWEST:
+      return reduce_keep(rolls, n, keep, 0);
+    case DICE_REDUCE_SUM:
+    default:
+      result = 0;
+      for (size_t i = 0; i < n; i++) result += rolls[i];
+      return result;
+  }
+}
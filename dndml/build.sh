@@ -10,8 +10,8 @@ elif [ "$1" = "--dndlex" ]; then
   gcc -c dnd_input_reader.c -Wall -std=gnu11
   echo "gcc -c dnd_lexer.c -Wall -std=gnu11"
   gcc -c dnd_lexer.c -Wall -std=gnu11
-  echo "gcc test_dnd_lexer.c dnd_lexer.o dnd_input_reader.o -o test-lex.x86 -Wall -std=gnu11"
-  gcc test_dnd_lexer.c dnd_lexer.o dnd_input_reader.o -o test-lex.x86 -Wall -std=gnu11
+  echo "gcc test_dnd_lexer.c dnd_lexer.o dnd_input_reader.o ../file_cache.o -o test-lex.x86 -Wall -std=gnu11 -lpthread"
+  gcc test_dnd_lexer.c dnd_lexer.o dnd_input_reader.o ../file_cache.o -o test-lex.x86 -Wall -std=gnu11 -lpthread
 elif [ "$1" == "--dndparse" ]; then
   echo "gcc -c dnd_input_reader.c -Wall -std=gnu11 -g -fvar-tracking"
   gcc -c dnd_input_reader.c -Wall -std=gnu11 -g -fvar-tracking
@@ -26,15 +26,17 @@ elif [ "$1" == "--dndparse" ]; then
   dnd_lexer.o         \
   dnd_charsheet.o     \
   dnd_parser.o        \
-  ../dstrcat.o        \
-  -o test-parser.x86 -Wall -std=gnu11 -g -fvar-tracking"
+  ../strbuf.o         \
+  ../file_cache.o     \
+  -o test-parser.x86 -Wall -std=gnu11 -g -fvar-tracking -lpthread"
   gcc test_dnd_parser.c \
   dnd_input_reader.o  \
   dnd_lexer.o         \
   dnd_charsheet.o     \
   dnd_parser.o        \
-  ../dstrcat.o        \
-  -o test-parser.x86 -Wall -std=gnu11 -g -fvar-tracking
+  ../strbuf.o         \
+  ../file_cache.o     \
+  -o test-parser.x86 -Wall -std=gnu11 -g -fvar-tracking -lpthread
 elif [ "$1" = "--clean" ]; then
   echo 'rm test*.x86'
   rm test*.x86
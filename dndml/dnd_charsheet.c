@@ -7,7 +7,7 @@
 #include "dnd_lexer.h"
 #include "dnd_charsheet.h"
 #include "../dice.h"
-#include "../dstrcat.h"
+#include "../strbuf.h"
 
 #ifdef DEBUG_LVL
   #if DEBUG_LVL == 0
@@ -26,9 +26,6 @@
   #define DEBUG2(x) ;
 #endif
 
-#define GLOBAL_BUF_SIZE 2048UL
-static char global_buf[GLOBAL_BUF_SIZE];
-
 void free_charsheet(charsheet_t *csp) {
   for (int i = 0; i < csp->section_count; i++) {
     for (int j = 0; j < csp->sections[i].field_count; j++) {
@@ -53,209 +50,125 @@ void free_charsheet(charsheet_t *csp) {
   free(csp);
 }
 
+// appends value, or NULL if it's INT_MIN
+static void put_int_or_null(strbuf_t *sb, int value) {
+  if (value == INT_MIN) strbuf_puts(sb, "NULL");
+  else strbuf_append_int(sb, value);
+}
+
+// appends an %item, indented to sit inside an %itemlist
+static void put_item(strbuf_t *sb, const item_t *item) {
+  strbuf_puts(sb, "    %item[val:");
+  if (item->val == NULL) {
+    strbuf_puts(sb, "NULL");
+  } else {
+    strbuf_putc(sb, '"');
+    strbuf_puts(sb, item->val);
+    strbuf_putc(sb, '"');
+  }
+  strbuf_puts(sb, ";qty:");
+  put_int_or_null(sb, item->qty);
+  strbuf_puts(sb, ";weight:");
+  if (isnan(item->weight)) strbuf_puts(sb, "NULL");
+  else strbuf_printf(sb, "%.2f", item->weight);
+  strbuf_puts(sb, "];\n");
+}
+
 char *charsheet_to_str(charsheet_t *csp) {
-  char *result = NULL;
+  strbuf_t sb;
+  strbuf_init(&sb);
   int timestamp = time(NULL);
-  snprintf(
-    global_buf, GLOBAL_BUF_SIZE,
+  strbuf_printf(
+    &sb,
     "~~ Character sheet autogenerated by tryptobot.\n"
     "~~ Timestamp: %d\n\n",
     timestamp // TODO: this is vulnerable to the 2038 problem
   );
-  result = dstrcat(result, global_buf);
 
   for (int i = 0; i < csp->section_count; i++) {
+    const section_t *section = csp->sections + i;
     DEBUG2(
       fprintf(
         stderr,
         "~~   Attempting to cat \"%s\".\n",
-        csp->sections[i].identifier
+        section->identifier
       );
     );
-    snprintf(global_buf, GLOBAL_BUF_SIZE, "@section %s:\n",
-      csp->sections[i].identifier);
-    result = dstrcat(
-      result,
-      global_buf
-    );
-    for (int j = 0; j < csp->sections[i].field_count; j++) {
+    strbuf_puts(&sb, "@section ");
+    strbuf_puts(&sb, section->identifier);
+    strbuf_puts(&sb, ":\n");
+    for (int j = 0; j < section->field_count; j++) {
+      const field_t *field = section->fields + j;
       DEBUG2(
         fprintf(
           stderr,
           "~~   Attempting to cat \"%s\".\n",
-          csp->sections[i].fields[j].identifier
+          field->identifier
         );
       );
-      snprintf(
-        global_buf,
-        GLOBAL_BUF_SIZE,
-        "  @field %s: ",
-        csp->sections[i].fields[j].identifier
-      );
-      result = dstrcat(
-        result,
-        global_buf
-      );
-      switch (csp->sections[i].fields[j].type) {
+      strbuf_puts(&sb, "  @field ");
+      strbuf_puts(&sb, field->identifier);
+      strbuf_puts(&sb, ": ");
+      switch (field->type) {
         case stat_val:
-          result = dstrcat(result, "%stat[ability:");
-          if (csp->sections[i].fields[j].stat_val.ability == INT_MIN) {
-            result = dstrcat(result, "NULL;mod:");
-          } else {
-            snprintf(global_buf, GLOBAL_BUF_SIZE, "%d;mod:",
-              csp->sections[i].fields[j].stat_val.ability);
-            result = dstrcat(result, global_buf);
-          }
-          if (csp->sections[i].fields[j].stat_val.mod == INT_MIN) {
-            result = dstrcat(result, "NULL];\n");
-          } else {
-            snprintf(global_buf, GLOBAL_BUF_SIZE, "%d];\n",
-              csp->sections[i].fields[j].stat_val.mod);
-            result = dstrcat(result, global_buf);
-          }
+          strbuf_puts(&sb, "%stat[ability:");
+          put_int_or_null(&sb, field->stat_val.ability);
+          strbuf_puts(&sb, ";mod:");
+          put_int_or_null(&sb, field->stat_val.mod);
+          strbuf_puts(&sb, "];\n");
         break;
         case string_val:
-          if (csp->sections[i].fields[j].string_val == NULL) {
-            result = dstrcat(result, "%string[NULL];\n");
+          if (field->string_val == NULL) {
+            strbuf_puts(&sb, "%string[NULL];\n");
           } else {
-            snprintf(global_buf, GLOBAL_BUF_SIZE,
-              "%%string[\"%s\"];\n",
-              csp->sections[i].fields[j].string_val
-            );
-            result = dstrcat(result, global_buf);
+            strbuf_puts(&sb, "%string[\"");
+            strbuf_puts(&sb, field->string_val);
+            strbuf_puts(&sb, "\"];\n");
           }
         break;
         case int_val:
-          if (csp->sections[i].fields[j].int_val == INT_MIN) {
-            result = dstrcat(result, "%int[NULL];\n");
-          } else {
-            snprintf(global_buf, GLOBAL_BUF_SIZE,
-              "%%int[%d];\n",
-              csp->sections[i].fields[j].int_val);
-            result = dstrcat(
-              result,
-              global_buf
-            );
-          }
+          strbuf_puts(&sb, "%int[");
+          put_int_or_null(&sb, field->int_val);
+          strbuf_puts(&sb, "];\n");
         break;
         case dice_val:
-          result = dstrcat(result, "%dice[");
-          if (csp->sections[i].fields[j].dice_val.value == INT_MIN) {
-            result = dstrcat(result, "NULL];\n");
+          strbuf_puts(&sb, "%dice[");
+          if (field->dice_val.value == INT_MIN) {
+            strbuf_puts(&sb, "NULL];\n");
           } else {
-            snprintf(
-              global_buf, GLOBAL_BUF_SIZE,
-              "%dd%d+%d];\n",
-              csp->sections[i].fields[j].dice_val.dice_ct,
-              csp->sections[i].fields[j].dice_val.faces,
-              csp->sections[i].fields[j].dice_val.modifier
-            );
-            result = dstrcat(result, global_buf);
+            strbuf_append_int(&sb, field->dice_val.dice_ct);
+            strbuf_putc(&sb, 'd');
+            strbuf_append_int(&sb, field->dice_val.faces);
+            strbuf_putc(&sb, '+');
+            strbuf_append_int(&sb, field->dice_val.modifier);
+            strbuf_puts(&sb, "];\n");
           }
         break;
         case deathsave_val:
-          result = dstrcat(result, "%deathsaves[succ:");
-          if (csp->sections[i].fields[j].deathsave_val.succ == INT_MIN) {
-            result = dstrcat(result, "NULL;fail:");
-          } else {
-            snprintf(
-              global_buf, GLOBAL_BUF_SIZE, "%d;fail:",
-              csp->sections[i].fields[j].deathsave_val.succ
-            );
-            result = dstrcat(result, global_buf);
-          }
-          if (csp->sections[i].fields[j].deathsave_val.fail == INT_MIN) {
-            result = dstrcat(result, "NULL];\n");
-          } else {
-            snprintf(
-              global_buf, GLOBAL_BUF_SIZE, "%d];\n",
-              csp->sections[i].fields[j].deathsave_val.fail
-            );
-            result = dstrcat(result, global_buf);
-          }
+          strbuf_puts(&sb, "%deathsaves[succ:");
+          put_int_or_null(&sb, field->deathsave_val.succ);
+          strbuf_puts(&sb, ";fail:");
+          put_int_or_null(&sb, field->deathsave_val.fail);
+          strbuf_puts(&sb, "];\n");
         break;
         case itemlist_val:
-          result = dstrcat(result, "%itemlist[\n");
-          for (
-            int k = 0;
-            k < csp->sections[i].fields[j].itemlist_val.item_count;
-            k++
-          ) {
-            result = dstrcat(result, "    %item[val:");
-            if (csp->sections[i].fields[j].itemlist_val.items[k].val == NULL) {
-              result = dstrcat(result, "NULL;qty:");
-            } else {
-              snprintf(
-                global_buf, GLOBAL_BUF_SIZE,
-                "\"%s\";qty:",
-                csp->sections[i].fields[j].itemlist_val.items[k].val
-              );
-              result = dstrcat(result, global_buf);
-            }
-            if (csp->sections[i].fields[j].itemlist_val.items[k].qty == INT_MIN) {
-              result = dstrcat(result, "NULL;weight:");
-            } else {
-              snprintf(
-                global_buf, GLOBAL_BUF_SIZE,
-                "%d;weight:",
-                csp->sections[i].fields[j].itemlist_val.items[k].qty
-              );
-              result = dstrcat(result, global_buf);
-            }
-            if (isnan(csp->sections[i].fields[j].itemlist_val.items[k].weight)) {
-              result = dstrcat(result, "NULL];\n");
-            } else {
-              snprintf(
-                global_buf, GLOBAL_BUF_SIZE,
-                "%.2f];\n",
-                csp->sections[i].fields[j].itemlist_val.items[k].weight
-              );
-              result = dstrcat(result, global_buf);
-            }
+          strbuf_puts(&sb, "%itemlist[\n");
+          for (int k = 0; k < field->itemlist_val.item_count; k++) {
+            put_item(&sb, field->itemlist_val.items + k);
           }
-          result = dstrcat(result, "  ];\n");
+          strbuf_puts(&sb, "  ];\n");
         break;
         case item_val:
-          result = dstrcat(result, "    %item[val:");
-          if (csp->sections[i].fields[j].item_val.val == NULL) {
-            result = dstrcat(result, "NULL;qty:");
-          } else {
-            snprintf(
-              global_buf, GLOBAL_BUF_SIZE,
-              "\"%s\";qty:",
-              csp->sections[i].fields[j].item_val.val
-            );
-            result = dstrcat(result, global_buf);
-          }
-          if (csp->sections[i].fields[j].item_val.qty == INT_MIN) {
-            result = dstrcat(result, "NULL;weight:");
-          } else {
-            snprintf(
-              global_buf, GLOBAL_BUF_SIZE,
-              "%d;weight:",
-              csp->sections[i].fields[j].item_val.qty
-            );
-            result = dstrcat(result, global_buf);
-          }
-          if (isnan(csp->sections[i].fields[j].item_val.weight)) {
-            result = dstrcat(result, "NULL];\n");
-          } else {
-            snprintf(
-              global_buf, GLOBAL_BUF_SIZE,
-              "%.2f];\n",
-              csp->sections[i].fields[j].item_val.weight
-            );
-            result = dstrcat(result, global_buf);
-          }
+          put_item(&sb, &field->item_val);
         break;
         default:
-          free(result);
+          strbuf_free(&sb);
           return NULL;
         break;
       }
     }
-    result = dstrcat(result, "@end-section\n\n");
+    strbuf_puts(&sb, "@end-section\n\n");
   }
 
-  return result;
+  return strbuf_detach(&sb);
 }
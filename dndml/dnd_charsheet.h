@@ -7,7 +7,8 @@
 #include "../dice.h"
 
 // fields set to INT_MIN if NULL
-typedef struct stat { int ability, mod; } stat_t;
+// not `struct stat`, which would clash with <sys/stat.h>
+typedef struct ability_stat { int ability, mod; } stat_t;
 typedef struct deathsave { int succ, fail; } deathsave_t;
 
 typedef struct item {
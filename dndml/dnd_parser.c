@@ -3,11 +3,13 @@
 #include <math.h>
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
 #include "dnd_input_reader.h"
 #include "dnd_lexer.h"
 #include "dnd_charsheet.h"
 #include "dnd_parser.h"
 #include "../dice.h"
+#include "../file_cache.h"
 
 #ifdef DEBUG_LVL
   #if DEBUG_LVL == 0
@@ -58,12 +60,33 @@ static enum parser_err parser_consume(
   return parser_syntax_error;
 }
 
+#define ERRLOG_PATH "/home/runner/tryptobot/dndml/errlog.txt"
+
+// serializes writes to errlog.txt between threads parsing at once
+static pthread_mutex_t errlog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * errlog.txt is replaced by renaming a fresh file over it instead of
+ * being rewritten in place, since `%dnd wtf` may have the old one
+ * mapped (see file_cache.h). Both must be called with errlog_lock held.
+ */
+static FILE *open_errlog(void) {
+  return fopen(ERRLOG_PATH ".tmp", "w");
+}
+
+static void close_errlog(FILE *f) {
+  fclose(f);
+  rename(ERRLOG_PATH ".tmp", ERRLOG_PATH);
+  file_cache_invalidate(ERRLOG_PATH);
+}
+
 // Prints output to last_parser_err.txt and stderr
 static inline void err_message(
   enum parser_err err,
   const char *expected_object
 ) {
-  FILE *f = fopen("/home/runner/tryptobot/dndml/errlog.txt", "w+");
+  pthread_mutex_lock(&errlog_lock);
+  FILE *f = open_errlog();
   switch (err) {
     case parser_syntax_error:
       fprintf(
@@ -90,7 +113,8 @@ static inline void err_message(
       fprintf(f, "Error: unknown error code `%d`", err);
     break;
   }
-  fclose(f);
+  close_errlog(f);
+  pthread_mutex_unlock(&errlog_lock);
 }
 
 // mandatory forward declarations
@@ -890,9 +914,8 @@ void construct_parser(parser_t *dest, lexer_t *lex, char *src_filename) {
   do {
     current_token = dest->lexer->get_next_token(dest->lexer);
     if (current_token.type == syntax_error) {
-      FILE *log = fopen(
-        "/home/runner/tryptobot/dndml/errlog.txt", "w+"
-      );
+      pthread_mutex_lock(&errlog_lock);
+      FILE *log = open_errlog();
       fprintf(
         stderr,
         "Syntax error in token stream generated while parsing.\n"
@@ -901,7 +924,8 @@ void construct_parser(parser_t *dest, lexer_t *lex, char *src_filename) {
         log,
         "Syntax error in token stream generated while parsing.\n"
       );
-      fclose(log);
+      close_errlog(log);
+      pthread_mutex_unlock(&errlog_lock);
       free(dest->token_vec.tokens);
       dest->token_vec.tokens = NULL;
       dest->token_vec.token_count = 0;
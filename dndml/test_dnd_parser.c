@@ -1,37 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "../file_cache.h"
 #include "dnd_input_reader.h"
 #include "dnd_lexer.h"
 #include "dnd_charsheet.h"
 #include "dnd_parser.h"
 
-// copied straight from tryptobot.c; quick hack but it works
-static char *load_file_to_str(const char *filename) {
-  FILE *f = fopen(filename, "rb");
-  char *result;
-  if (f) {
-    fseek(f, 0, SEEK_END);
-    long length = ftell(f);
-    int x;
-    fseek(f, 0, SEEK_SET);
-    result = malloc(length+1);
-    if (result) {
-      x = fread(result, 1, length, f);
-      result[x] = '\0';
-    } else {
-      fprintf(stderr, "Memory allocation error\n");
-      fclose(f);
-      return NULL;
-    }
-  } else {
-    fprintf(stderr, "Unable to find `%s`\n", filename);
-    return NULL;
-  }
-  fclose(f);
-  return result;
-}
-
 /*
  gcc -c dnd_input_reader.c -Wall -std=gnu11
  gcc -c dnd_lexer.c -Wall -std=gnu11
@@ -42,7 +17,9 @@ static char *load_file_to_str(const char *filename) {
   dnd_lexer.o         \
   dnd_charsheet.o     \
   dnd_parser.o        \
-  -o test-parser.x86 -Wall -std=gnu11
+  ../strbuf.o         \
+  ../file_cache.o     \
+  -o test-parser.x86 -Wall -std=gnu11 -lpthread
  ./test-parser.x86 [file to parse]
  */
 int main(int argc, char *argv[]) {
@@ -51,14 +28,14 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  char *file_contents = load_file_to_str(argv[1]);
-  if (file_contents == NULL) {
+  file_view_t file;
+  if (file_cache_acquire(argv[1], &file)) {
     printf("error: %s: no such file or directory\n", argv[1]);
     return 1;
   }
 
   input_reader_t ir;
-  construct_input_reader(&ir, file_contents);
+  construct_input_reader(&ir, file.data);
 
   lexer_t lex;
   construct_lexer(&lex, &ir);
@@ -67,6 +44,7 @@ int main(int argc, char *argv[]) {
   construct_parser(&parser, &lex, argv[1]);
 
   charsheet_t *charsheet = parser.parse(&parser);
+  file_cache_release(&file);
 
   if (charsheet == NULL) {
     printf("parser.parse() returned a NULL object.\n");
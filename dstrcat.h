@@ -1,6 +0,0 @@
-#ifndef DSTRCAT_H
-#define DSTRCAT_H
-
-char *dstrcat(char *dest, const char *str_to_append);
-
-#endif //DSTRCAT_H
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "file_cache.h"
+
+struct mapped_file {
+  char *path; // heap-allocated
+  char *data; // the mapping
+  size_t len;
+  size_t map_len; // len rounded up past the '\0' to a whole page
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  time_t last_check;
+  uint64_t last_used;
+  size_t refcount; // views, plus 1 while it's in the table
+};
+
+// the table, use_clock and every refcount are guarded by cache_lock
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static mapped_file_t *table[FILE_CACHE_MAX]; // NULL marks an empty slot
+static unsigned int table_hash[FILE_CACHE_MAX]; // path_hash() of each path
+static uint64_t use_clock = 0;
+
+// plain 32-bit FNV-1a
+static unsigned int path_hash(const char *path) {
+  unsigned int h = 2166136261U;
+  for (; *path; path++) {
+    h ^= (unsigned char) *path;
+    h *= 16777619U;
+  }
+  return h;
+}
+
+// must be called with cache_lock held
+static void unref_locked(mapped_file_t *file) {
+  if (--file->refcount == 0) {
+    munmap(file->data, file->map_len);
+    free(file->path);
+    free(file);
+  }
+}
+
+/**
+ * Maps the len bytes of fd with a '\0' after them. Whole zeroed pages
+ * are reserved first and the file is mapped over the front of them:
+ * the rest of the file's last page reads as zeroes, and if the file
+ * ends on a page boundary the '\0' comes from the reserved page after
+ * it. Returns NULL on failure.
+ */
+static char *map_with_nul(int fd, size_t len, size_t *map_len) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  *map_len = (len / page + 1) * page;
+  char *data = mmap(
+    NULL, *map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+  );
+  if (data == MAP_FAILED) return NULL;
+  if (len > 0 && mmap(
+    data, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0
+  ) == MAP_FAILED) {
+    munmap(data, *map_len);
+    return NULL;
+  }
+  return data;
+}
+
+// maps the file at path; returns NULL on failure
+static mapped_file_t *map_file(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return NULL;
+  struct stat st;
+  mapped_file_t *file = NULL;
+  if (!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+    file = calloc(1, sizeof(mapped_file_t));
+  }
+  if (file != NULL) {
+    file->len = st.st_size;
+    file->data = map_with_nul(fd, file->len, &file->map_len);
+    file->path = strdup(path);
+    if (file->data == NULL || file->path == NULL) {
+      if (file->data != NULL) munmap(file->data, file->map_len);
+      free(file->path);
+      free(file);
+      file = NULL;
+    } else {
+      file->dev = st.st_dev;
+      file->ino = st.st_ino;
+      file->mtime = st.st_mtim;
+      file->refcount = 1;
+    }
+  }
+  close(fd); // the mapping doesn't need it
+  return file;
+}
+
+/**
+ * Returns the mapping of path from the table, mapping it (again) if it
+ * isn't there or has changed since, or NULL. Must be called with
+ * cache_lock held.
+ */
+static mapped_file_t *find_file_locked(const char *path) {
+  unsigned int hash = path_hash(path);
+  size_t slot = FILE_CACHE_MAX;
+  for (size_t i = 0; i < FILE_CACHE_MAX; i++) {
+    if (table_hash[i] == hash && table[i] != NULL
+        && !strcmp(table[i]->path, path)) {
+      slot = i;
+      break;
+    }
+  }
+
+  time_t now = time(NULL);
+  if (slot < FILE_CACHE_MAX) {
+    mapped_file_t *file = table[slot];
+    if (file->last_check == now) return file;
+    struct stat st;
+    if (!stat(path, &st)
+        && st.st_dev == file->dev
+        && st.st_ino == file->ino
+        && st.st_mtim.tv_sec == file->mtime.tv_sec
+        && st.st_mtim.tv_nsec == file->mtime.tv_nsec) {
+      file->last_check = now;
+      return file;
+    }
+    // changed or gone; views of the old mapping keep it alive
+    table[slot] = NULL;
+    unref_locked(file);
+  } else {
+    // an empty slot, or else the least recently used file
+    slot = 0;
+    for (size_t i = 0; i < FILE_CACHE_MAX && table[slot] != NULL; i++) {
+      if (table[i] == NULL || table[i]->last_used < table[slot]->last_used)
+        slot = i;
+    }
+    if (table[slot] != NULL) {
+      unref_locked(table[slot]);
+      table[slot] = NULL;
+    }
+  }
+
+  mapped_file_t *file = map_file(path);
+  if (file == NULL) return NULL;
+  file->last_check = now;
+  table[slot] = file;
+  table_hash[slot] = hash;
+  return file;
+}
+
+int file_cache_acquire(const char *path, file_view_t *view) {
+  pthread_mutex_lock(&cache_lock);
+  mapped_file_t *file = find_file_locked(path);
+  if (file != NULL) {
+    file->refcount++;
+    file->last_used = ++use_clock;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  if (file == NULL) {
+    memset(view, 0, sizeof(file_view_t));
+    return -1;
+  }
+  view->data = file->data;
+  view->len = file->len;
+  view->dev = file->dev;
+  view->ino = file->ino;
+  view->mtime = file->mtime;
+  view->file = file;
+  return 0;
+}
+
+void file_cache_release(file_view_t *view) {
+  if (view->file == NULL) return;
+  pthread_mutex_lock(&cache_lock);
+  unref_locked(view->file);
+  pthread_mutex_unlock(&cache_lock);
+  memset(view, 0, sizeof(file_view_t));
+}
+
+void file_cache_invalidate(const char *path) {
+  unsigned int hash = path_hash(path);
+  pthread_mutex_lock(&cache_lock);
+  for (size_t i = 0; i < FILE_CACHE_MAX; i++) {
+    if (table_hash[i] == hash && table[i] != NULL
+        && !strcmp(table[i]->path, path))
+      table[i]->last_check = 0;
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+char *load_file_to_str(const char *filename) {
+  file_view_t view;
+  if (file_cache_acquire(filename, &view)) {
+    fprintf(stderr, "Unable to find `%s`\n", filename);
+    return NULL;
+  }
+  char *result = malloc(view.len + 1);
+  if (result) {
+    memcpy(result, view.data, view.len + 1);
+  } else {
+    fprintf(stderr, "Memory allocation error\n");
+  }
+  file_cache_release(&view);
+  return result;
+}
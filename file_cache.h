@@ -0,0 +1,64 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+// most files kept mapped at once; the least recently used goes first
+#define FILE_CACHE_MAX 64
+
+/**
+ * A read-only file cache for the files the backend reads over and over
+ * (character sheets, errlog.txt, commands.json). Each file is mapped
+ * with mmap() once and the mapping is shared by every reader, so
+ * reading a cached file copies nothing and, within the same second,
+ * makes no syscalls: a file is stat()ed at most once per second, and
+ * mapped again only when its dev, inode or mtime has changed.
+ *
+ * A mapping that's been replaced stays valid for as long as views of
+ * it are held. Because of that, files should be replaced by renaming a
+ * new file over them rather than rewritten in place: truncating a file
+ * that's mapped makes reading past its new end a SIGBUS.
+ */
+
+typedef struct mapped_file mapped_file_t;
+
+// a borrowed, read-only view of a whole file
+typedef struct file_view {
+  const char *data; // the file's contents, followed by a '\0'
+  size_t len; // not counting the '\0'
+  dev_t dev; // identity of the file that was mapped
+  ino_t ino;
+  struct timespec mtime;
+  mapped_file_t *file; // what file_cache_release() gives back
+} file_view_t;
+
+/**
+ * Fills *view with the contents of the regular file at path. Returns 0
+ * on success and -1 if the file can't be opened or mapped. Safe to
+ * call from any thread; the view stays valid, even if the file is
+ * changed or evicted meanwhile, until it's passed to
+ * file_cache_release().
+ */
+int file_cache_acquire(const char *path, file_view_t *view);
+
+// drops a view obtained from file_cache_acquire()
+void file_cache_release(file_view_t *view);
+
+/**
+ * Makes the next file_cache_acquire() of path check the file again
+ * even if it was checked this second. For code in this process that
+ * has just replaced the file, so its readers see the new contents
+ * right away.
+ */
+void file_cache_invalidate(const char *path);
+
+/**
+ * Returns a heap-allocated, '\0'-terminated copy of the contents of
+ * filename (which the caller must free), or NULL if it can't be read.
+ * Goes through the cache; use a view instead to avoid the copy.
+ */
+char *load_file_to_str(const char *filename);
+
+#endif // FILE_CACHE_H
@@ -0,0 +1,86 @@
+# Generates `cmd_dispatch.h`, the perfect-hash command dispatch table
+# used by handle_message() in tryptobot.c. main.py runs this before
+# recompiling the backend, so to add a command, add one entry to
+# COMMANDS below (and the matching `cmd_*` function to tryptobot.c and
+# `STAT_*` id to stats.h).
+
+COMMANDS = [
+  ("%commands", "cmd_commands", "STAT_COMMANDS"),
+  ("%cmdinfo", "cmd_cmdinfo", "STAT_CMDINFO"),
+  ("%reverse", "cmd_reverse", "STAT_REVERSE"),
+  ("%roll", "cmd_roll", "STAT_ROLL"),
+  ("%reroll", "cmd_reroll", "STAT_REROLL"),
+  ("%odds", "cmd_odds", "STAT_ODDS"),
+  ("%simulate", "cmd_simulate", "STAT_SIMULATE"),
+  ("%rollstats", "cmd_rollstats", "STAT_ROLLSTATS"),
+  ("%calcmod", "cmd_calcmod", "STAT_CALCMOD"),
+  ("%dnd", "cmd_dnd", "STAT_DND"),
+  ("%stats", "cmd_stats", "STAT_STATS"),
+]
+
+OUTPUT_FILE = "cmd_dispatch.h"
+
+
+# must match cmd_hash() in tryptobot.c (32-bit FNV-1a with a seed). The
+# low bits of FNV-1a only depend on the low bits of the seed, so the
+# high half is folded in; otherwise only `slots` seeds would differ.
+def cmd_hash(seed, name):
+  h = seed
+  for c in name.encode("utf-8"):
+    h ^= c
+    h = (h * 16777619) & 0xFFFFFFFF
+  return h ^ (h >> 16)
+
+
+def find_seed(names, slots):
+  for seed in range(1, 1 << 24):
+    used = set()
+    for name in names:
+      slot = cmd_hash(seed, name) & (slots - 1)
+      if slot in used:
+        break
+      used.add(slot)
+    else:
+      return seed
+  return None
+
+
+def main():
+  names = [name for name, _, _ in COMMANDS]
+  if len(set(names)) != len(names):
+    raise SystemExit("gen_dispatch.py: duplicate command name")
+
+  # keep the table at most half full so a seed is found quickly
+  slots = 1
+  while slots < 2 * len(names):
+    slots *= 2
+  seed = None
+  while seed is None:
+    seed = find_seed(names, slots)
+    if seed is None:
+      slots *= 2
+
+  entries = sorted(
+    (cmd_hash(seed, name) & (slots - 1), name, handler, stat)
+    for name, handler, stat in COMMANDS
+  )
+  with open(OUTPUT_FILE, "w") as f:
+    f.write("// Generated by gen_dispatch.py; do not edit by hand.\n")
+    f.write("#ifndef CMD_DISPATCH_H\n")
+    f.write("#define CMD_DISPATCH_H\n\n")
+    f.write("#define CMD_DISPATCH_SEED 0x%08xU\n" % seed)
+    f.write("#define CMD_DISPATCH_SLOTS %d\n\n" % slots)
+    f.write(
+      "static const cmd_entry_t cmd_dispatch_table[CMD_DISPATCH_SLOTS] = {\n"
+    )
+    for slot, name, handler, stat in entries:
+      f.write(
+        '  [%d] = { "%s", %d, &%s, %s },\n'
+        % (slot, name, len(name), handler, stat)
+      )
+    f.write("};\n\n")
+    f.write("#endif // CMD_DISPATCH_H\n")
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,164 @@
+# Generates `grapheme_tables.h`, the Unicode property tables that
+# utf8_reverse.c uses to find grapheme cluster boundaries (UAX #29).
+# Unlike gen_dispatch.py, this isn't run by main.py: it needs two files
+# from the Unicode Character Database, so run it by hand when moving
+# to a new Unicode version and commit the result:
+#
+#   python3 gen_grapheme_tables.py <dir>
+#
+# where <dir> holds GraphemeBreakProperty.txt (from ucd/auxiliary/)
+# and emoji-data.txt (from ucd/emoji/).
+
+import os
+import re
+import sys
+
+OUTPUT_FILE = "grapheme_tables.h"
+
+# the C enum, in order; GCB_OTHER must stay 0
+PROPS = [
+  ("Other", "GCB_OTHER"),
+  ("CR", "GCB_CR"),
+  ("LF", "GCB_LF"),
+  ("Control", "GCB_CONTROL"),
+  ("Extend", "GCB_EXTEND"),
+  ("ZWJ", "GCB_ZWJ"),
+  ("Regional_Indicator", "GCB_REGIONAL_INDICATOR"),
+  ("Prepend", "GCB_PREPEND"),
+  ("SpacingMark", "GCB_SPACING_MARK"),
+  ("L", "GCB_L"),
+  ("V", "GCB_V"),
+  ("T", "GCB_T"),
+  ("LV", "GCB_LV"),
+  ("LVT", "GCB_LVT"),
+  # from emoji-data.txt; no code point has it and a GCB value as well
+  ("Extended_Pictographic", "GCB_EXTENDED_PICTOGRAPHIC"),
+]
+
+CODE_POINTS = 0x110000
+# Hangul syllables alternate between LV and LVT every 28 code points,
+# which would take dozens of distinct blocks; utf8_reverse.c works them
+# out arithmetically instead, so they're left out of the tables
+HANGUL_FIRST, HANGUL_LAST, HANGUL_T_COUNT = 0xAC00, 0xD7A3, 28
+LINE_RE = re.compile(r"^([0-9A-F]+)(?:\.\.([0-9A-F]+))?\s*;\s*(\w+)")
+VERSION_RE = re.compile(r"^#\s*\S+-(\d+\.\d+\.\d+)\.txt")
+
+
+# yields (first, last, property) for each range in a UCD file, and
+# returns the Unicode version from its header
+def read_ucd(path, ranges):
+  version = None
+  with open(path, encoding="utf-8") as f:
+    for line in f:
+      if version is None:
+        m = VERSION_RE.match(line)
+        if m:
+          version = m.group(1)
+      m = LINE_RE.match(line)
+      if m:
+        first = int(m.group(1), 16)
+        last = int(m.group(2), 16) if m.group(2) else first
+        ranges.append((first, last, m.group(3)))
+  return version
+
+
+def build_props(ucd_dir):
+  values = {name: i for i, (name, _) in enumerate(PROPS)}
+  props = bytearray(CODE_POINTS)
+
+  gcb = []
+  version = read_ucd(os.path.join(ucd_dir, "GraphemeBreakProperty.txt"), gcb)
+  for first, last, name in gcb:
+    if name not in values:
+      raise SystemExit(f"gen_grapheme_tables.py: unknown property {name}")
+    props[first:last + 1] = bytes([values[name]]) * (last - first + 1)
+
+  emoji = []
+  read_ucd(os.path.join(ucd_dir, "emoji-data.txt"), emoji)
+  pictographic = values["Extended_Pictographic"]
+  for first, last, name in emoji:
+    if name != "Extended_Pictographic":
+      continue
+    for cp in range(first, last + 1):
+      if props[cp] != 0:
+        raise SystemExit(
+          f"gen_grapheme_tables.py: U+{cp:04X} is Extended_Pictographic "
+          "and has a grapheme break property"
+        )
+      props[cp] = pictographic
+
+  for cp in range(HANGUL_FIRST, HANGUL_LAST + 1):
+    expected = "LVT" if (cp - HANGUL_FIRST) % HANGUL_T_COUNT else "LV"
+    if props[cp] != values[expected]:
+      raise SystemExit(f"gen_grapheme_tables.py: U+{cp:04X} isn't {expected}")
+    props[cp] = 0
+  return props, version
+
+
+# two-stage table: stage1[cp >> shift] picks a block of stage2, and
+# identical blocks are stored once; two properties are packed per byte
+def split_tables(props, shift):
+  block_size = 1 << shift
+  blocks, stage1, stage2 = {}, [], bytearray()
+  for start in range(0, CODE_POINTS, block_size):
+    block = bytes(props[start:start + block_size])
+    if block not in blocks:
+      blocks[block] = len(blocks)
+      for i in range(0, block_size, 2):
+        stage2.append(block[i] | block[i + 1] << 4)
+    stage1.append(blocks[block])
+  return stage1, stage2
+
+
+def c_array(values, per_line=16):
+  lines = []
+  for i in range(0, len(values), per_line):
+    lines.append("  " + ", ".join(str(v) for v in values[i:i + per_line]) + ",")
+  return "\n".join(lines)
+
+
+def main():
+  if len(sys.argv) != 2:
+    raise SystemExit("usage: python3 gen_grapheme_tables.py <ucd dir>")
+  props, version = build_props(sys.argv[1])
+
+  # the block size that makes the two stages smallest in total
+  best = None
+  for shift in range(4, 12):
+    stage1, stage2 = split_tables(props, shift)
+    if max(stage1) > 0xFF:
+      continue
+    size = len(stage1) + len(stage2)
+    if best is None or size < best[0]:
+      best = (size, shift, stage1, stage2)
+  size, shift, stage1, stage2 = best
+
+  enum = "\n".join(f"  {c_name}," for _, c_name in PROPS)
+  with open(OUTPUT_FILE, "w") as f:
+    f.write(
+      f"// Generated by gen_grapheme_tables.py from Unicode {version}; "
+      "do not edit by hand.\n"
+      "#ifndef GRAPHEME_TABLES_H\n"
+      "#define GRAPHEME_TABLES_H\n\n"
+      "#include <stdint.h>\n\n"
+      "// Grapheme_Cluster_Break, plus Extended_Pictographic\n"
+      f"enum grapheme_prop {{\n{enum}\n}};\n\n"
+      f"#define GRAPHEME_UNICODE_VERSION \"{version}\"\n"
+      f"#define GRAPHEME_BLOCK_SHIFT {shift}\n"
+      "// the tables say GCB_OTHER for these; they're LV or LVT\n"
+      f"#define GRAPHEME_HANGUL_FIRST 0x{HANGUL_FIRST:04X}\n"
+      f"#define GRAPHEME_HANGUL_LAST 0x{HANGUL_LAST:04X}\n"
+      f"#define GRAPHEME_HANGUL_T_COUNT {HANGUL_T_COUNT}\n\n"
+      "// indexed by code point >> GRAPHEME_BLOCK_SHIFT\n"
+      f"static const uint8_t grapheme_stage1[{len(stage1)}] = {{\n"
+      f"{c_array(stage1)}\n}};\n\n"
+      "// blocks of properties, two per byte (low nibble first)\n"
+      f"static const uint8_t grapheme_stage2[{len(stage2)}] = {{\n"
+      f"{c_array(stage2)}\n}};\n\n"
+      "#endif // GRAPHEME_TABLES_H\n"
+    )
+  print(f"gen_grapheme_tables.py: {size} bytes of tables, block size {1 << shift}")
+
+
+if __name__ == "__main__":
+  main()
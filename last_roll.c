@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include "strbuf.h"
+#include "last_roll.h"
+
+/**
+ * The table is split into shards with a lock each, so rolls from
+ * different users rarely wait on each other. Within a shard a pair
+ * lives in one of the LAST_ROLL_PROBE slots after its hash, so a
+ * lookup checks at most that many slots and nothing is ever deleted;
+ * when all of them are taken, the least recently stored one is
+ * replaced.
+ */
+#define LAST_ROLL_SHARDS 16
+#define LAST_ROLL_SHARD_SLOTS 256 // must be a power of 2
+#define LAST_ROLL_PROBE 8
+
+// how long the writer waits after a change, to batch up any that follow
+#define LAST_ROLL_FLUSH_DELAY_MS 2000
+
+/**
+ * File format (native byte order):
+ *   "TBLR", uint32 version, uint32 record count, then for each record
+ *   uint64 user, uint64 channel, uint8 n, n bytes of spec
+ */
+#define LAST_ROLL_MAGIC "TBLR"
+#define LAST_ROLL_VERSION 2
+
+typedef struct last_roll_entry {
+  int used;
+  uint64_t user_id, channel_id;
+  uint64_t stamp; // when it was stored, in shard-local ticks
+  char spec[LAST_ROLL_SPEC_MAX];
+} last_roll_entry_t;
+
+typedef struct last_roll_shard {
+  pthread_mutex_t lock;
+  uint64_t clock;
+  last_roll_entry_t entries[LAST_ROLL_SHARD_SLOTS];
+} last_roll_shard_t;
+
+static last_roll_shard_t shards[LAST_ROLL_SHARDS];
+
+static void init_table(void);
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+// both set once, by init_table()
+static const char *table_path = LAST_ROLL_PATH;
+static char tmp_path[PATH_MAX];
+static atomic_int dirty; // set when the table has changed since the last write
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER; // one write at a time
+
+static uint64_t mix_ids(uint64_t user_id, uint64_t channel_id) {
+  uint64_t h = user_id * 0x9E3779B97F4A7C15ULL ^ channel_id;
+  h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+  return h ^ (h >> 31);
+}
+
+// stores spec without marking the table dirty; shard must be locked
+static void shard_store(
+  last_roll_shard_t *shard,
+  uint64_t h,
+  uint64_t user_id,
+  uint64_t channel_id,
+  const char *spec,
+  size_t spec_len
+) {
+  last_roll_entry_t *victim = NULL;
+  for (int i = 0; i < LAST_ROLL_PROBE; i++) {
+    last_roll_entry_t *e =
+      shard->entries + ((h + i) & (LAST_ROLL_SHARD_SLOTS - 1));
+    if (e->used && e->user_id == user_id && e->channel_id == channel_id) {
+      victim = e;
+      break;
+    }
+    if (victim != NULL && !victim->used) continue;
+    if (!e->used || victim == NULL || e->stamp < victim->stamp) victim = e;
+  }
+  victim->used = 1;
+  victim->user_id = user_id;
+  victim->channel_id = channel_id;
+  victim->stamp = ++shard->clock;
+  if (spec_len >= LAST_ROLL_SPEC_MAX) spec_len = LAST_ROLL_SPEC_MAX - 1;
+  memcpy(victim->spec, spec, spec_len);
+  victim->spec[spec_len] = '\0';
+}
+
+static last_roll_shard_t *shard_for(uint64_t h) {
+  // the low bits pick the slot, so pick the shard with the high ones
+  return shards + (h >> 60) % LAST_ROLL_SHARDS;
+}
+
+/**
+ * Whether spec could have been stored by `%roll`: arguments separated
+ * by single spaces, with no empty ones and no control chars.
+ */
+static int spec_is_valid(const char *spec, size_t spec_len) {
+  if (spec_len == 0 || spec_len >= LAST_ROLL_SPEC_MAX) return 0;
+  if (spec[0] == ' ' || spec[spec_len - 1] == ' ') return 0;
+  for (size_t i = 0; i < spec_len; i++) {
+    unsigned char c = spec[i];
+    if (c < ' ' || c == 0x7f) return 0;
+    if (c == ' ' && spec[i + 1] == ' ') return 0;
+  }
+  return 1;
+}
+
+static int read_exact(FILE *f, void *dest, size_t size) {
+  return fread(dest, 1, size, f) == size ? 0 : -1;
+}
+
+// the old format: one global roll, "dice:<expr>;val:<value>;"
+static void load_legacy(void) {
+  FILE *f = fopen(LEGACY_LAST_ROLL_PATH, "r");
+  if (f == NULL) return;
+  char expr[64];
+  if (fscanf(f, "dice:%63[^;];", expr) == 1) {
+    uint64_t h = mix_ids(0, 0);
+    shard_store(shard_for(h), h, 0, 0, expr, strlen(expr));
+  }
+  fclose(f);
+}
+
+static void load_table(void) {
+  FILE *f = fopen(table_path, "rb");
+  if (f == NULL) {
+    if (!strcmp(table_path, LAST_ROLL_PATH)) load_legacy();
+    return;
+  }
+  char magic[4];
+  uint32_t version, count;
+  if (read_exact(f, magic, 4) || memcmp(magic, LAST_ROLL_MAGIC, 4)
+      || read_exact(f, &version, sizeof(version))
+      || version != LAST_ROLL_VERSION
+      || read_exact(f, &count, sizeof(count))) {
+    fprintf(stderr, "`%s` is malformed\n", table_path);
+    fclose(f);
+    return;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t user_id, channel_id;
+    uint8_t spec_len;
+    char spec[LAST_ROLL_SPEC_MAX];
+    if (read_exact(f, &user_id, sizeof(user_id))
+        || read_exact(f, &channel_id, sizeof(channel_id))
+        || read_exact(f, &spec_len, sizeof(spec_len))
+        || read_exact(f, spec, spec_len)) {
+      fprintf(stderr, "`%s` is truncated\n", table_path);
+      break;
+    }
+    if (!spec_is_valid(spec, spec_len)) {
+      fprintf(stderr, "`%s` has a malformed roll; skipping it\n", table_path);
+      continue;
+    }
+    uint64_t h = mix_ids(user_id, channel_id);
+    shard_store(shard_for(h), h, user_id, channel_id, spec, spec_len);
+  }
+  fclose(f);
+}
+
+// serializes every shard into out, one shard lock at a time
+static int snapshot_table(strbuf_t *out) {
+  uint32_t version = LAST_ROLL_VERSION, count = 0;
+  strbuf_append(out, LAST_ROLL_MAGIC, 4);
+  strbuf_append(out, (const char *) &version, sizeof(version));
+  size_t count_at = out->len;
+  strbuf_append(out, (const char *) &count, sizeof(count));
+  for (int s = 0; s < LAST_ROLL_SHARDS; s++) {
+    last_roll_shard_t *shard = shards + s;
+    pthread_mutex_lock(&shard->lock);
+    for (int i = 0; i < LAST_ROLL_SHARD_SLOTS; i++) {
+      const last_roll_entry_t *e = shard->entries + i;
+      if (!e->used) continue;
+      uint8_t spec_len = strlen(e->spec);
+      strbuf_append(out, (const char *) &e->user_id, sizeof(e->user_id));
+      strbuf_append(out, (const char *) &e->channel_id, sizeof(e->channel_id));
+      strbuf_append(out, (const char *) &spec_len, sizeof(spec_len));
+      strbuf_append(out, e->spec, spec_len);
+      count++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+  if (out->data == NULL || out->len < count_at + sizeof(count)) return -1;
+  memcpy(out->data + count_at, &count, sizeof(count));
+  return 0;
+}
+
+int last_roll_flush(void) {
+  pthread_once(&init_once, init_table);
+  atomic_store(&dirty, 0);
+  strbuf_t snapshot;
+  strbuf_init(&snapshot);
+  if (snapshot_table(&snapshot)) {
+    strbuf_free(&snapshot);
+    fprintf(stderr, "Memory allocation error\n");
+    return -1;
+  }
+
+  // write a temporary file and rename it over the old one, so a crash
+  // mid-write never leaves a half-written table behind
+  int failed = 0;
+  pthread_mutex_lock(&file_lock);
+  FILE *f = fopen(tmp_path, "wb");
+  if (f == NULL) {
+    failed = 1;
+  } else {
+    failed |= fwrite(snapshot.data, 1, snapshot.len, f) != snapshot.len;
+    failed |= fflush(f) != 0 || fsync(fileno(f)) != 0;
+    failed |= fclose(f) != 0;
+    failed = failed || rename(tmp_path, table_path) != 0;
+  }
+  pthread_mutex_unlock(&file_lock);
+  strbuf_free(&snapshot);
+  if (failed) {
+    fprintf(stderr, "Unable to write to `%s`\n", table_path);
+    atomic_store(&dirty, 1); // try again next time
+    return -1;
+  }
+  return 0;
+}
+
+static void *writer_main(void *arg) {
+  pthread_mutex_lock(&writer_lock);
+  while (1) {
+    while (!atomic_load(&dirty)) pthread_cond_wait(&writer_wake, &writer_lock);
+    pthread_mutex_unlock(&writer_lock);
+    struct timespec delay = {
+      LAST_ROLL_FLUSH_DELAY_MS / 1000,
+      LAST_ROLL_FLUSH_DELAY_MS % 1000 * 1000000L
+    };
+    nanosleep(&delay, NULL);
+    last_roll_flush();
+    pthread_mutex_lock(&writer_lock);
+  }
+  return NULL;
+}
+
+static void flush_at_exit(void) {
+  if (atomic_load(&dirty)) last_roll_flush();
+}
+
+static void init_table(void) {
+  const char *path = getenv(LAST_ROLL_PATH_ENV);
+  if (path != NULL && *path != '\0'
+      && strlen(path) + sizeof(".tmp") <= sizeof(tmp_path)) {
+    table_path = path;
+  }
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", table_path);
+  for (int s = 0; s < LAST_ROLL_SHARDS; s++) {
+    pthread_mutex_init(&shards[s].lock, NULL);
+  }
+  load_table();
+
+  pthread_t writer;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&writer, &attr, writer_main, NULL)) {
+    fprintf(stderr, "Unable to start the last roll writer thread\n");
+  }
+  pthread_attr_destroy(&attr);
+  atexit(flush_at_exit);
+}
+
+int last_roll_get(uint64_t user_id, uint64_t channel_id, char *spec) {
+  pthread_once(&init_once, init_table);
+  uint64_t h = mix_ids(user_id, channel_id);
+  last_roll_shard_t *shard = shard_for(h);
+  int found = -1;
+  pthread_mutex_lock(&shard->lock);
+  for (int i = 0; i < LAST_ROLL_PROBE; i++) {
+    const last_roll_entry_t *e =
+      shard->entries + ((h + i) & (LAST_ROLL_SHARD_SLOTS - 1));
+    if (e->used && e->user_id == user_id && e->channel_id == channel_id) {
+      memcpy(spec, e->spec, LAST_ROLL_SPEC_MAX);
+      found = 0;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return found;
+}
+
+void last_roll_put(uint64_t user_id, uint64_t channel_id, const char *spec) {
+  pthread_once(&init_once, init_table);
+  uint64_t h = mix_ids(user_id, channel_id);
+  last_roll_shard_t *shard = shard_for(h);
+  pthread_mutex_lock(&shard->lock);
+  shard_store(shard, h, user_id, channel_id, spec, strlen(spec));
+  pthread_mutex_unlock(&shard->lock);
+
+  // only the first change since the last write has to wake the writer
+  if (!atomic_exchange(&dirty, 1)) {
+    pthread_mutex_lock(&writer_lock);
+    pthread_cond_signal(&writer_wake);
+    pthread_mutex_unlock(&writer_lock);
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef LAST_ROLL_H
+#define LAST_ROLL_H
+
+#include <stdint.h>
+
+#define LAST_ROLL_PATH "/home/runner/tryptobot/lastrolls.bin"
+// if set in the environment, the table is kept here instead (e.g. by benchmarks)
+#define LAST_ROLL_PATH_ENV "TRYPTOBOT_LAST_ROLL_PATH"
+/**
+ * Read once, if LAST_ROLL_PATH doesn't exist yet, to keep the old
+ * global last roll. Not read when LAST_ROLL_PATH_ENV is set.
+ */
+#define LEGACY_LAST_ROLL_PATH "/home/runner/tryptobot/lastroll.txt"
+
+/**
+ * Room for the arguments of a `%roll`, including the '\0', which is
+ * also the longest `%roll` accepts (commands.json says so). It's stored
+ * on disk in a byte, so it can't grow past 256 without a new format.
+ */
+#define LAST_ROLL_SPEC_MAX 256
+
+/**
+ * The most recent roll of each (user, channel) pair, held in memory as
+ * the arguments it was rolled with (e.g. "1d20+3 2x2d6"), so that a
+ * reroll rolls all of them again. Storing a roll never touches the
+ * disk: a background thread writes the whole table to LAST_ROLL_PATH
+ * (or the file named by LAST_ROLL_PATH_ENV when the table is first
+ * used) shortly after it changes, so a burst of rolls costs one write.
+ * The table is loaded from that file the first time it's used. It holds a
+ * bounded number of pairs; once it fills up, storing a roll for a new
+ * pair evicts a pair that hasn't rolled in a while.
+ */
+
+/**
+ * Copies the pair's last roll into spec, which must have room for
+ * LAST_ROLL_SPEC_MAX chars, and returns 0, or returns -1 if the pair
+ * has no last roll.
+ */
+int last_roll_get(uint64_t user_id, uint64_t channel_id, char *spec);
+
+// spec is cut off at LAST_ROLL_SPEC_MAX - 1 chars
+void last_roll_put(uint64_t user_id, uint64_t channel_id, const char *spec);
+
+/**
+ * Writes the table to LAST_ROLL_PATH now, without waiting for the
+ * background thread. Also runs at exit. Returns 0 or -1 on failure.
+ */
+int last_roll_flush(void);
+
+#endif // LAST_ROLL_H
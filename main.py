@@ -1,3 +1,5 @@
+import asyncio
+import itertools
 import discord
 import pycld2 as cld2
 import os
@@ -6,9 +8,23 @@ import rebuilder
 from keep_alive import keep_alive
 
 
-rebuilder.exec("gcc -fPIC -c dstrcat.c -o dstrcat.o -DDEBUG_LVL=0")
+rebuilder.exec("python3 gen_dispatch.py")
 rebuilder.exec("gcc -fPIC -c copy_file.c -o copy_file.o")
+rebuilder.exec("gcc -fPIC -c file_cache.c -o file_cache.o")
+rebuilder.exec("gcc -fPIC -O2 -c strbuf.c -o strbuf.o")
+rebuilder.exec("gcc -fPIC -c stats.c -o stats.o")
+rebuilder.exec("gcc -fPIC -c dice.c -o dice.o")
+rebuilder.exec("gcc -fPIC -O2 -c dice_kernel.c -o dice_kernel.o")
+rebuilder.exec("gcc -fPIC -c dice_expr.c -o dice_expr.o")
+rebuilder.exec("gcc -fPIC -O2 -c odds.c -o odds.o")
+rebuilder.exec("gcc -fPIC -O2 -c simulate.c -o simulate.o")
+rebuilder.exec("gcc -fPIC -c last_roll.c -o last_roll.o")
+rebuilder.exec("gcc -fPIC -c roll_log.c -o roll_log.o")
 rebuilder.exec("gcc -fPIC -c charsheet_utils.c -o charsheet_utils.o")
+rebuilder.exec("gcc -fPIC -c charsheet_cache.c -o charsheet_cache.o")
+rebuilder.exec("gcc -fPIC -O2 -c utf8_reverse.c -o utf8_reverse.o")
+rebuilder.exec("gcc -fPIC -c command_catalog.c -o command_catalog.o")
+rebuilder.exec("gcc -fPIC -c worker_pool.c -o worker_pool.o")
 rebuilder.exec(
   "gcc -fPIC -c dndml/dnd_input_reader.c "
   "-o dndml/dnd_input_reader.o"
@@ -27,14 +43,27 @@ rebuilder.exec(
 )
 rebuilder.exec(
   "gcc -fPIC -shared tryptobot.c "
-  "dstrcat.o "
   "dndml/dnd_input_reader.o "
   "dndml/dnd_lexer.o "
   "dndml/dnd_charsheet.o "
   "dndml/dnd_parser.o "
   "charsheet_utils.o "
+  "charsheet_cache.o "
+  "utf8_reverse.o "
   "copy_file.o "
-  "-o libtryptobot.so -lm"
+  "file_cache.o "
+  "command_catalog.o "
+  "worker_pool.o "
+  "strbuf.o "
+  "stats.o "
+  "dice.o "
+  "dice_kernel.o "
+  "dice_expr.o "
+  "odds.o "
+  "simulate.o "
+  "last_roll.o "
+  "roll_log.o "
+  "-o libtryptobot.so -lm -lpthread"
 )
 print("Recompiled `libtryptobot.so`.")
 libc = ctypes.CDLL("libc.so.6")
@@ -42,9 +71,117 @@ libtrypto = ctypes.CDLL("./libtryptobot.so")
 libtrypto.handle_message.argtypes = (ctypes.c_char_p,)
 libtrypto.handle_message.restype = ctypes.POINTER(ctypes.c_char)
 
+
+class StrBuf(ctypes.Structure):
+  _fields_ = [
+    ("data", ctypes.POINTER(ctypes.c_char)),
+    ("len", ctypes.c_size_t),
+    ("cap", ctypes.c_size_t)
+  ]
+
+libtrypto.handle_message_from.argtypes = (
+  ctypes.c_char_p,
+  ctypes.c_uint64,
+  ctypes.c_uint64,
+  ctypes.POINTER(StrBuf)
+)
+libtrypto.handle_message_from.restype = ctypes.c_size_t
+libtrypto.strbuf_clear.argtypes = (ctypes.POINTER(StrBuf),)
+libtrypto.strbuf_clear.restype = None
+reply_buf = StrBuf() # reused by every synchronous call, so it rarely allocates
+
+
+class Completion(ctypes.Structure):
+  _fields_ = [
+    ("tag", ctypes.c_uint64),
+    ("reply", ctypes.POINTER(ctypes.c_char)),
+    ("error", ctypes.c_char_p)
+  ]
+
+libtrypto.start_worker_pool.argtypes = (ctypes.c_size_t, ctypes.c_size_t)
+libtrypto.start_worker_pool.restype = ctypes.c_int
+libtrypto.submit_message.argtypes = (
+  ctypes.c_char_p,
+  ctypes.c_uint64,
+  ctypes.c_uint64,
+  ctypes.c_uint64
+)
+libtrypto.submit_message.restype = ctypes.c_int
+libtrypto.poll_completions.argtypes = (
+  ctypes.POINTER(Completion),
+  ctypes.c_size_t
+)
+libtrypto.poll_completions.restype = ctypes.c_size_t
+
+WORKER_THREADS = 4
+WORKER_QUEUE_CAPACITY = 256
+worker_eventfd = -1
+pending_replies = {} # tag -> future awaiting the reply
+next_tag = itertools.count()
+completions = (Completion * 64)()
+
+
+def start_workers():
+  """Starts the backend's worker pool and watches its eventfd."""
+  global worker_eventfd
+  if worker_eventfd >= 0:
+    return
+  worker_eventfd = libtrypto.start_worker_pool(
+    WORKER_THREADS, WORKER_QUEUE_CAPACITY
+  )
+  if worker_eventfd >= 0:
+    asyncio.get_running_loop().add_reader(worker_eventfd, drain_completions)
+  else:
+    print("Unable to start worker pool; handling commands synchronously")
+
+
+def drain_completions():
+  try:
+    os.read(worker_eventfd, 8) # reset the eventfd before polling
+  except BlockingIOError:
+    pass
+  while True:
+    n = libtrypto.poll_completions(completions, len(completions))
+    for i in range(n):
+      raw = completions[i].reply
+      if raw:
+        reply = ctypes.cast(raw, ctypes.c_char_p).value.decode()
+        libc.free(raw)
+      else: # the backend couldn't allocate the reply
+        reply = (completions[i].error or b"Backend error").decode()
+      future = pending_replies.pop(completions[i].tag, None)
+      if future is not None and not future.done():
+        future.set_result(reply)
+    if n < len(completions):
+      break
+
+
+async def handle_message_async(content, user_id, channel_id):
+  """Runs a message from user_id in channel_id through the backend
+  without blocking the event loop."""
+  msg = bytes(content, encoding="utf-8")
+  tag = next(next_tag)
+  future = asyncio.get_running_loop().create_future()
+  pending_replies[tag] = future
+  if (worker_eventfd < 0
+      or libtrypto.submit_message(msg, user_id, channel_id, tag)):
+    # pool isn't running or is full, so handle it on this thread
+    del pending_replies[tag]
+    libtrypto.strbuf_clear(ctypes.byref(reply_buf))
+    offset = libtrypto.handle_message_from(
+      msg, user_id, channel_id, ctypes.byref(reply_buf)
+    )
+    if not reply_buf.data:
+      return "Backend error"
+    base = ctypes.addressof(reply_buf.data.contents)
+    return ctypes.string_at(base + offset).decode()
+  return await future
+
+
 client = discord.Client()
 @client.event
 async def on_ready():
+  start_workers()
   print("Tryptobot online")
   print(client.user)
 
@@ -66,13 +203,10 @@ async def on_message(message):
         horny_user = message.content[6:]
         await message.channel.send(f"{horny_user} go to horny jail", file=discord.File("cheems.png"))
       else:
-        result = libtrypto.handle_message(
-          ctypes.c_char_p(bytes(message.content, encoding="utf-8"))
-        )
-        await message.channel.send(
-          ctypes.cast(result, ctypes.c_char_p).value.decode()
+        reply = await handle_message_async(
+          message.content, message.author.id, message.channel.id
         )
-        libc.free(result)
+        await message.channel.send(reply)
 
 keep_alive()
 token = os.environ.get("DISCORD_BOT_SECRET")
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "dice_expr.h"
+#include "odds.h"
+
+// below this many points in the shorter operand, convolve directly
+#define DIRECT_CONVOLVE_MAX 64
+
+static int dist_alloc(dice_dist_t *dist, long long offset, size_t len) {
+  dist->offset = offset;
+  dist->len = len;
+  dist->p = calloc(len, sizeof(double));
+  return dist->p == NULL ? -1 : 0;
+}
+
+void dice_dist_free(dice_dist_t *dist) {
+  free(dist->p);
+  dist->p = NULL;
+  dist->len = 0;
+}
+
+static int dist_copy(dice_dist_t *dest, const dice_dist_t *src) {
+  if (dist_alloc(dest, src->offset, src->len)) return -1;
+  memcpy(dest->p, src->p, src->len * sizeof(double));
+  return 0;
+}
+
+// in-place iterative radix-2 FFT; n must be a power of 2
+static void fft(double *re, double *im, size_t n, int inverse) {
+  for (size_t i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      double t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+  for (size_t len = 2; len <= n; len <<= 1) {
+    double angle = (inverse ? 2 : -2) * M_PI / len;
+    for (size_t k = 0; k < len / 2; k++) {
+      // computed directly rather than by recurrence, to keep the error small
+      double w_re = cos(angle * k), w_im = sin(angle * k);
+      for (size_t i = k; i < n; i += len) {
+        size_t j = i + len / 2;
+        double x_re = re[j] * w_re - im[j] * w_im;
+        double x_im = re[j] * w_im + im[j] * w_re;
+        re[j] = re[i] - x_re;
+        im[j] = im[i] - x_im;
+        re[i] += x_re;
+        im[i] += x_im;
+      }
+    }
+  }
+}
+
+static int convolve_fft(const dice_dist_t *a, const dice_dist_t *b, dice_dist_t *out) {
+  size_t n = 1;
+  while (n < out->len) n <<= 1;
+  double *buf = calloc(4 * n, sizeof(double));
+  if (buf == NULL) return -1;
+  double *a_re = buf, *a_im = buf + n, *b_re = buf + 2 * n, *b_im = buf + 3 * n;
+  memcpy(a_re, a->p, a->len * sizeof(double));
+  fft(a_re, a_im, n, 0);
+  if (a == b) {
+    // squaring a distribution only needs one forward transform
+    b_re = a_re;
+    b_im = a_im;
+  } else {
+    memcpy(b_re, b->p, b->len * sizeof(double));
+    fft(b_re, b_im, n, 0);
+  }
+  for (size_t i = 0; i < n; i++) {
+    double re = a_re[i] * b_re[i] - a_im[i] * b_im[i];
+    double im = a_re[i] * b_im[i] + a_im[i] * b_re[i];
+    a_re[i] = re;
+    a_im[i] = im;
+  }
+  fft(a_re, a_im, n, 1);
+  for (size_t i = 0; i < out->len; i++) {
+    // rounding error can leave tiny negative probabilities
+    double p = a_re[i] / n;
+    out->p[i] = p > 0 ? p : 0;
+  }
+  free(buf);
+  return 0;
+}
+
+// the distribution of the sum of independent draws from a and b
+static const char *convolve(
+  const dice_dist_t *a,
+  const dice_dist_t *b,
+  dice_dist_t *out
+) {
+  size_t len = a->len + b->len - 1;
+  if (len > DICE_DIST_MAX_LEN) return "That roll has too many possible totals.";
+  if (dist_alloc(out, a->offset + b->offset, len)) {
+    return "Memory allocation error";
+  }
+  size_t shorter = a->len < b->len ? a->len : b->len;
+  if (shorter <= DIRECT_CONVOLVE_MAX) {
+    for (size_t i = 0; i < a->len; i++) {
+      if (a->p[i] == 0) continue;
+      for (size_t j = 0; j < b->len; j++) out->p[i + j] += a->p[i] * b->p[j];
+    }
+  } else if (convolve_fft(a, b, out)) {
+    dice_dist_free(out);
+    return "Memory allocation error";
+  }
+  return NULL;
+}
+
+/**
+ * Memo of the distributions of NdF, keyed on (count, faces), shared
+ * by every thread. Entries are copied in and out under the lock, so
+ * an eviction never pulls a distribution out from under a reader.
+ */
+#define DIST_CACHE_SLOTS 64
+// longer distributions are cheap to recompute relative to their size
+#define DIST_CACHE_MAX_LEN (1 << 16)
+
+typedef struct dist_cache_entry {
+  int count, faces;
+  dice_dist_t dist; // dist.p is NULL if the slot is empty
+} dist_cache_entry_t;
+
+static pthread_mutex_t dist_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static dist_cache_entry_t dist_cache[DIST_CACHE_SLOTS];
+static size_t dist_cache_next = 0; // next slot to replace
+
+static int dist_cache_get(int count, int faces, dice_dist_t *dest) {
+  int found = -1;
+  pthread_mutex_lock(&dist_cache_lock);
+  for (size_t i = 0; i < DIST_CACHE_SLOTS; i++) {
+    dist_cache_entry_t *e = dist_cache + i;
+    if (e->dist.p != NULL && e->count == count && e->faces == faces) {
+      found = dist_copy(dest, &e->dist);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&dist_cache_lock);
+  return found;
+}
+
+static void dist_cache_put(int count, int faces, const dice_dist_t *dist) {
+  if (dist->len > DIST_CACHE_MAX_LEN) return;
+  dice_dist_t copy;
+  if (dist_copy(&copy, dist)) return;
+  pthread_mutex_lock(&dist_cache_lock);
+  dist_cache_entry_t *e = dist_cache + dist_cache_next;
+  dist_cache_next = (dist_cache_next + 1) % DIST_CACHE_SLOTS;
+  dice_dist_free(&e->dist);
+  e->count = count;
+  e->faces = faces;
+  e->dist = copy;
+  pthread_mutex_unlock(&dist_cache_lock);
+}
+
+// NdF by binary exponentiation of the single die's distribution
+static const char *dice_term_dist(int count, int faces, dice_dist_t *out) {
+  if (count == 0 || faces == 1) {
+    if (dist_alloc(out, count, 1)) return "Memory allocation error";
+    out->p[0] = 1;
+    return NULL;
+  }
+  if ((long long) count * (faces - 1) + 1 > DICE_DIST_MAX_LEN) {
+    return "That roll has too many possible totals.";
+  }
+  if (!dist_cache_get(count, faces, out)) return NULL;
+
+  dice_dist_t power; // the distribution of power_ct dice
+  int power_ct = 1;
+  if (dist_alloc(&power, 1, faces)) return "Memory allocation error";
+  for (int i = 0; i < faces; i++) power.p[i] = 1.0 / faces;
+
+  dice_dist_t result = { 0, 0, NULL };
+  const char *err = NULL;
+  for (int remaining = count; ; ) {
+    if (remaining & 1) {
+      dice_dist_t sum;
+      if (result.p == NULL) {
+        err = dist_copy(&result, &power) ? "Memory allocation error" : NULL;
+      } else if ((err = convolve(&result, &power, &sum)) == NULL) {
+        dice_dist_free(&result);
+        result = sum;
+      }
+      if (err) break;
+    }
+    remaining >>= 1;
+    if (remaining == 0) break;
+
+    dice_dist_t squared;
+    power_ct *= 2;
+    if (dist_cache_get(power_ct, faces, &squared)) {
+      if ((err = convolve(&power, &power, &squared))) break;
+      dist_cache_put(power_ct, faces, &squared);
+    }
+    dice_dist_free(&power);
+    power = squared;
+  }
+  dice_dist_free(&power);
+  if (err) {
+    dice_dist_free(&result);
+    return err;
+  }
+  dist_cache_put(count, faces, &result);
+  *out = result;
+  return NULL;
+}
+
+static void dist_negate(dice_dist_t *dist) {
+  for (size_t i = 0, j = dist->len - 1; i < j; i++, j--) {
+    double t = dist->p[i];
+    dist->p[i] = dist->p[j];
+    dist->p[j] = t;
+  }
+  dist->offset = -(dist->offset + (long long) dist->len - 1);
+}
+
+// scales every total of dist by factor
+static const char *dist_scale(
+  const dice_dist_t *dist,
+  long long factor,
+  dice_dist_t *out
+) {
+  long long magnitude = factor < 0 ? -factor : factor;
+  if (factor == 0) {
+    if (dist_alloc(out, 0, 1)) return "Memory allocation error";
+    out->p[0] = 1;
+    return NULL;
+  }
+  long long offset;
+  if ((dist->len - 1) * (double) magnitude + 1 > DICE_DIST_MAX_LEN) {
+    return "That roll has too many possible totals.";
+  }
+  if (__builtin_mul_overflow(dist->offset, magnitude, &offset)) {
+    return "The result of that roll is too big.";
+  }
+  if (dist_alloc(out, offset, (dist->len - 1) * magnitude + 1)) {
+    return "Memory allocation error";
+  }
+  for (size_t i = 0; i < dist->len; i++) out->p[i * magnitude] = dist->p[i];
+  if (factor < 0) dist_negate(out);
+  return NULL;
+}
+
+const char *dice_program_dist(const dice_program_t *program, dice_dist_t *out) {
+  dice_dist_t stack[DICE_EXPR_MAX];
+  int top = 0;
+  const char *err = NULL;
+
+  for (int pc = 0; pc < program->code_len && err == NULL; ) {
+    dice_dist_t result;
+    switch (program->code[pc++]) {
+      case DICE_OP_CONST:
+        if (dist_alloc(&result, program->consts[program->code[pc++]], 1)) {
+          err = "Memory allocation error";
+          break;
+        }
+        result.p[0] = 1;
+        stack[top++] = result;
+      break;
+      case DICE_OP_DICE: {
+        const dice_term_t *term = program->terms + program->code[pc++];
+        if (term->explode || term->keep_mode != DICE_KEEP_ALL) {
+          err = "`%odds` can only work out sums of plain dice for now, "
+                "not keep/drop or exploding dice.";
+          break;
+        }
+        if ((err = dice_term_dist(term->count, term->faces, &result))) break;
+        stack[top++] = result;
+      }
+      break;
+      case DICE_OP_SUB:
+        dist_negate(stack + top - 1);
+        // fall through
+      case DICE_OP_ADD:
+        if ((err = convolve(stack + top - 2, stack + top - 1, &result))) break;
+        dice_dist_free(stack + --top);
+        dice_dist_free(stack + --top);
+        stack[top++] = result;
+      break;
+      case DICE_OP_MUL: {
+        dice_dist_t *a = stack + top - 2, *b = stack + top - 1;
+        if (a->len != 1 && b->len != 1) {
+          err = "`%odds` can't multiply two dice rolls together.";
+          break;
+        }
+        if (a->len == 1) err = dist_scale(b, a->offset, &result);
+        else err = dist_scale(a, b->offset, &result);
+        if (err) break;
+        dice_dist_free(stack + --top);
+        dice_dist_free(stack + --top);
+        stack[top++] = result;
+      }
+      break;
+      case DICE_OP_NEG:
+        dist_negate(stack + top - 1);
+      break;
+      default:
+        err = "Backend error: corrupt dice program";
+    }
+  }
+  if (err) {
+    while (top > 0) dice_dist_free(stack + --top);
+    return err;
+  }
+  *out = stack[0];
+  return NULL;
+}
+
+double dice_dist_mean(const dice_dist_t *dist) {
+  double mean = 0;
+  for (size_t i = 0; i < dist->len; i++) mean += (double) i * dist->p[i];
+  return dist->offset + mean;
+}
+
+double dice_dist_stddev(const dice_dist_t *dist) {
+  double mean = dice_dist_mean(dist) - dist->offset;
+  double variance = 0;
+  for (size_t i = 0; i < dist->len; i++) {
+    variance += (i - mean) * (i - mean) * dist->p[i];
+  }
+  return sqrt(variance);
+}
+
+long long dice_dist_percentile(const dice_dist_t *dist, double fraction) {
+  double cumulative = 0;
+  for (size_t i = 0; i < dist->len; i++) {
+    cumulative += dist->p[i];
+    // allow for rounding so that e.g. the median of 1d2 is 1
+    if (cumulative >= fraction - 1e-9) return dist->offset + i;
+  }
+  return dist->offset + dist->len - 1;
+}
+
+double dice_dist_at_least(const dice_dist_t *dist, long long target) {
+  if (target <= dist->offset) return 1;
+  if (target - dist->offset >= (long long) dist->len) return 0;
+  double total = 0;
+  for (size_t i = target - dist->offset; i < dist->len; i++) {
+    total += dist->p[i];
+  }
+  return total > 1 ? 1 : total;
+}
@@ -0,0 +1,42 @@
+#ifndef ODDS_H
+#define ODDS_H
+
+#include <stddef.h>
+#include "dice_expr.h"
+
+// widest distribution (number of possible totals) that will be computed
+#define DICE_DIST_MAX_LEN (1 << 18)
+
+/**
+ * An exact probability distribution over integer totals:
+ * P(X == offset + i) is p[i], for i in [0, len).
+ */
+typedef struct dice_dist {
+  long long offset;
+  size_t len;
+  double *p; // heap-allocated
+} dice_dist_t;
+
+/**
+ * Computes the distribution of program's total into *out by
+ * convolving the distributions of its terms (using an FFT once they
+ * get long). The distribution of each (count, faces) pair, including
+ * the intermediate powers used to build it, is memoized across calls.
+ * Only sums, differences and constant multiples of plain dice terms
+ * are supported. Returns NULL on success or an error message (a
+ * string literal); on success the caller must dice_dist_free() *out.
+ */
+const char *dice_program_dist(const dice_program_t *program, dice_dist_t *out);
+
+void dice_dist_free(dice_dist_t *dist);
+
+double dice_dist_mean(const dice_dist_t *dist);
+double dice_dist_stddev(const dice_dist_t *dist);
+
+// smallest total t such that P(X <= t) >= fraction
+long long dice_dist_percentile(const dice_dist_t *dist, double fraction);
+
+// P(X >= target)
+double dice_dist_at_least(const dice_dist_t *dist, long long target);
+
+#endif // ODDS_H
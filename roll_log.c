@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dice.h"
+#include "dice_expr.h"
+#include "roll_log.h"
+
+/**
+ * File layout: a roll_log_header_t, then ROLL_LOG_CAPACITY
+ * roll_record_ts. Record i holds the roll numbered i, i + capacity,
+ * i + 2 * capacity, ..., whichever was written last.
+ */
+#define ROLL_LOG_MAGIC "TBRL"
+#define ROLL_LOG_VERSION 1
+
+#define ROLL_RECORD_KEEP 0x1 // the term kept or dropped some dice
+#define ROLL_RECORD_EXPLODE 0x2
+
+typedef struct roll_log_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t capacity;
+  uint32_t record_size;
+  uint64_t written; // records ever written; the next goes in written % capacity
+} roll_log_header_t;
+
+typedef struct roll_record {
+  uint64_t user_id, channel_id;
+  int64_t total;
+  uint32_t time; // seconds since the epoch
+  uint32_t faces; // 0 if the record is unused
+  uint32_t count;
+  uint8_t flags;
+  uint8_t reserved[3];
+} roll_record_t;
+
+// the running totals for one (user, die size)
+typedef struct roll_agg {
+  uint64_t user_id;
+  uint32_t faces; // 0 marks an empty slot
+  uint64_t dice, singles;
+  long long sum;
+  uint32_t *hist; // faces counts, or NULL if the die is too big to tally
+} roll_agg_t;
+
+// everything is guarded by one lock; rolls come in at human speed
+static struct {
+  pthread_mutex_t lock;
+  int ready;
+  roll_log_header_t *header;
+  roll_record_t *records;
+  roll_agg_t *aggs; // open-addressed hash table
+  size_t agg_slots; // a power of 2
+  size_t agg_ct;
+} roll_log = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static size_t agg_hash(uint64_t user_id, uint32_t faces) {
+  uint64_t h = user_id * 0x9E3779B97F4A7C15ULL ^ faces;
+  h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  return h ^ (h >> 31);
+}
+
+static int agg_grow(void) {
+  size_t slots = roll_log.agg_slots ? 2 * roll_log.agg_slots : 64;
+  roll_agg_t *aggs = calloc(slots, sizeof(roll_agg_t));
+  if (aggs == NULL) return -1;
+  for (size_t i = 0; i < roll_log.agg_slots; i++) {
+    const roll_agg_t *old = roll_log.aggs + i;
+    if (old->faces == 0) continue;
+    size_t j = agg_hash(old->user_id, old->faces) & (slots - 1);
+    while (aggs[j].faces != 0) j = (j + 1) & (slots - 1);
+    aggs[j] = *old;
+  }
+  free(roll_log.aggs);
+  roll_log.aggs = aggs;
+  roll_log.agg_slots = slots;
+  return 0;
+}
+
+// finds (or adds) the aggregate for (user_id, faces); NULL if out of memory
+static roll_agg_t *agg_find(uint64_t user_id, uint32_t faces) {
+  if (4 * (roll_log.agg_ct + 1) > 3 * roll_log.agg_slots && agg_grow()) {
+    return NULL;
+  }
+  size_t mask = roll_log.agg_slots - 1;
+  size_t i = agg_hash(user_id, faces) & mask;
+  for (; roll_log.aggs[i].faces != 0; i = (i + 1) & mask) {
+    roll_agg_t *agg = roll_log.aggs + i;
+    if (agg->user_id == user_id && agg->faces == faces) return agg;
+  }
+  roll_agg_t *agg = roll_log.aggs + i;
+  if (faces <= ROLL_STATS_HIST_FACES_MAX) {
+    agg->hist = calloc(faces, sizeof(uint32_t));
+    if (agg->hist == NULL) return NULL;
+  }
+  agg->user_id = user_id;
+  agg->faces = faces;
+  roll_log.agg_ct++;
+  return agg;
+}
+
+// adds (sign = 1) or removes (sign = -1) a record from the aggregates
+static void agg_apply(const roll_record_t *rec, int sign) {
+  if (rec->faces == 0 || rec->flags != 0 || rec->count == 0) return;
+  const uint64_t users[2] = { rec->user_id, ROLL_STATS_ALL_USERS };
+  for (int u = 0; u < 2; u++) {
+    roll_agg_t *agg = agg_find(users[u], rec->faces);
+    if (agg == NULL) return;
+    agg->dice += sign * (int64_t) rec->count;
+    agg->sum += sign * rec->total;
+    if (rec->count == 1 && agg->hist != NULL
+        && rec->total >= 1 && rec->total <= rec->faces) {
+      agg->singles += sign;
+      agg->hist[rec->total - 1] += sign;
+    }
+  }
+}
+
+static void init_header(roll_log_header_t *header) {
+  memset(header, 0, sizeof(roll_log_header_t));
+  memcpy(header->magic, ROLL_LOG_MAGIC, 4);
+  header->version = ROLL_LOG_VERSION;
+  header->capacity = ROLL_LOG_CAPACITY;
+  header->record_size = sizeof(roll_record_t);
+}
+
+// maps the log file (or, failing that, anonymous memory); lock must be held
+static void open_log(void) {
+  size_t size = sizeof(roll_log_header_t)
+                + ROLL_LOG_CAPACITY * sizeof(roll_record_t);
+  void *map = MAP_FAILED;
+  const char *path = getenv(ROLL_LOG_PATH_ENV);
+  if (path == NULL || *path == '\0') path = ROLL_LOG_PATH;
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0
+      && (st.st_size == (off_t) size || ftruncate(fd, size) == 0)) {
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (fd >= 0) close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Unable to map `%s`; rolls won't be kept\n", path);
+    map = mmap(
+      NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if (map == MAP_FAILED) return;
+  }
+
+  roll_log.header = map;
+  roll_log.records = (roll_record_t *) (roll_log.header + 1);
+  roll_log_header_t expected;
+  init_header(&expected);
+  if (memcmp(roll_log.header, &expected, offsetof(roll_log_header_t, written))) {
+    // new, or from an incompatible version; start over
+    memset(map, 0, size);
+    *roll_log.header = expected;
+  }
+
+  uint64_t stored = roll_log.header->written < ROLL_LOG_CAPACITY ?
+                    roll_log.header->written : ROLL_LOG_CAPACITY;
+  for (uint64_t i = 0; i < stored; i++) agg_apply(roll_log.records + i, 1);
+  roll_log.ready = 1;
+}
+
+void roll_log_record(
+  uint64_t user_id,
+  uint64_t channel_id,
+  const dice_program_t *program,
+  const long long *term_values,
+  size_t roll_ct
+) {
+  size_t value_ct = roll_ct * program->term_ct;
+  uint32_t now = time(NULL);
+  pthread_mutex_lock(&roll_log.lock);
+  if (!roll_log.ready) open_log();
+  for (size_t i = 0; roll_log.ready && i < value_ct; i++) {
+    const dice_term_t *term = program->terms + i % program->term_ct;
+    roll_record_t *rec =
+      roll_log.records + roll_log.header->written % ROLL_LOG_CAPACITY;
+    agg_apply(rec, -1);
+    *rec = (roll_record_t){
+      .user_id = user_id,
+      .channel_id = channel_id,
+      .total = term_values[i],
+      .time = now,
+      .faces = term->faces,
+      .count = term->count,
+      .flags = (term->keep_mode != DICE_KEEP_ALL ? ROLL_RECORD_KEEP : 0)
+               | (term->explode ? ROLL_RECORD_EXPLODE : 0)
+    };
+    roll_log.header->written++;
+    agg_apply(rec, 1);
+  }
+  pthread_mutex_unlock(&roll_log.lock);
+}
+
+size_t roll_stats_get(uint64_t user_id, roll_stats_t *out, size_t max) {
+  size_t n = 0;
+  pthread_mutex_lock(&roll_log.lock);
+  if (!roll_log.ready) open_log();
+  for (size_t i = 0; i < roll_log.agg_slots; i++) {
+    const roll_agg_t *agg = roll_log.aggs + i;
+    if (agg->faces == 0 || agg->user_id != user_id || agg->dice == 0) continue;
+    // insertion sort by faces, keeping the max smallest dice
+    size_t pos = n;
+    while (pos > 0 && out[pos - 1].faces > agg->faces) pos--;
+    if (pos == max) continue;
+    if (n == max) n--;
+    memmove(out + pos + 1, out + pos, (n - pos) * sizeof(roll_stats_t));
+    n++;
+
+    roll_stats_t *stats = out + pos;
+    memset(stats, 0, sizeof(roll_stats_t));
+    stats->faces = agg->faces;
+    stats->dice = agg->dice;
+    stats->sum = agg->sum;
+    stats->singles = agg->singles;
+    if (agg->hist != NULL) {
+      for (uint32_t f = 0; f < agg->faces; f++) stats->hist[f] = agg->hist[f];
+    }
+  }
+  pthread_mutex_unlock(&roll_log.lock);
+  return n;
+}
+
+double roll_stats_chi_squared(const roll_stats_t *stats, int *dof) {
+  if (stats->faces < 2 || stats->faces > ROLL_STATS_HIST_FACES_MAX) return -1;
+  double expected = (double) stats->singles / stats->faces;
+  if (expected < 5) return -1;
+  double x = 0;
+  for (uint32_t f = 0; f < stats->faces; f++) {
+    double diff = stats->hist[f] - expected;
+    x += diff * diff / expected;
+  }
+  *dof = stats->faces - 1;
+  return x;
+}
+
+/**
+ * The regularized upper incomplete gamma function Q(a, x), by its
+ * series when x < a + 1 and by its continued fraction otherwise
+ * (Numerical Recipes, section 6.2).
+ */
+static double gamma_q(double a, double x) {
+  if (x <= 0) return 1;
+  int sign;
+  double log_prefix = -x + a * log(x) - lgamma_r(a, &sign);
+  if (x < a + 1) {
+    double term = 1 / a, sum = term;
+    for (int n = 1; n < 1000; n++) {
+      term *= x / (a + n);
+      sum += term;
+      if (fabs(term) < fabs(sum) * 1e-15) break;
+    }
+    return 1 - sum * exp(log_prefix);
+  }
+  const double tiny = 1e-300;
+  double b = x + 1 - a, c = 1 / tiny, d = 1 / b, h = d;
+  for (int i = 1; i < 1000; i++) {
+    double an = -i * (i - a);
+    b += 2;
+    d = an * d + b;
+    if (fabs(d) < tiny) d = tiny;
+    c = b + an / c;
+    if (fabs(c) < tiny) c = tiny;
+    d = 1 / d;
+    double delta = d * c;
+    h *= delta;
+    if (fabs(delta - 1) < 1e-15) break;
+  }
+  return exp(log_prefix) * h;
+}
+
+double chi_squared_p_value(double x, int dof) {
+  return gamma_q(dof / 2.0, x / 2.0);
+}
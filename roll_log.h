@@ -0,0 +1,75 @@
+#ifndef ROLL_LOG_H
+#define ROLL_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dice.h"
+#include "dice_expr.h"
+
+#define ROLL_LOG_PATH "/home/runner/tryptobot/rolllog.bin"
+// if set in the environment, the log is kept here instead (e.g. by benchmarks)
+#define ROLL_LOG_PATH_ENV "TRYPTOBOT_ROLL_LOG_PATH"
+// how many dice terms the log remembers before it wraps around
+#define ROLL_LOG_CAPACITY 65536
+
+// face histograms are only kept for dice with at most this many faces
+#define ROLL_STATS_HIST_FACES_MAX 100
+// pass as user_id to roll_stats_get() to get everyone's stats
+#define ROLL_STATS_ALL_USERS UINT64_MAX
+
+/**
+ * Every dice term rolled by `%roll` and `%reroll` is appended to a
+ * ring of fixed-size records in ROLL_LOG_PATH (or the file named by
+ * ROLL_LOG_PATH_ENV when the log is first used), which is
+ * memory-mapped, so logging a roll is a few stores and never waits on
+ * the disk. Per
+ * (user, die size) aggregates are kept in memory alongside it: each
+ * record is added to them when it's written and subtracted when the
+ * ring overwrites it, so they always describe exactly what's in the
+ * log and reading them never scans it.
+ */
+
+/**
+ * Logs roll_ct rolls of program by user_id in channel_id: every dice
+ * term of each, however many terms program has. term_values holds
+ * program->term_ct subtotals per roll, one roll after another, each
+ * as stored by dice_program_eval_terms().
+ */
+void roll_log_record(
+  uint64_t user_id,
+  uint64_t channel_id,
+  const dice_program_t *program,
+  const long long *term_values,
+  size_t roll_ct
+);
+
+// what the log says about one user's (or everyone's) dice of one size
+typedef struct roll_stats {
+  uint32_t faces;
+  // plain dice only; keep/drop and exploding dice aren't uniform
+  uint64_t dice;
+  long long sum; // the total of those dice
+  // terms that were a single plain die, tallied by the face they showed
+  uint64_t singles;
+  uint64_t hist[ROLL_STATS_HIST_FACES_MAX]; // hist[f - 1] is for face f
+} roll_stats_t;
+
+/**
+ * Copies the stats for user_id (or ROLL_STATS_ALL_USERS) for up to max
+ * die sizes into out, smallest die first, and returns how many were
+ * copied.
+ */
+size_t roll_stats_get(uint64_t user_id, roll_stats_t *out, size_t max);
+
+/**
+ * Pearson's chi-squared statistic of stats->hist against a fair die,
+ * with its degrees of freedom stored in *dof. Returns -1 if there are
+ * too few single rolls for the test to mean anything (fewer than 5
+ * expected per face) or no histogram was kept for this die.
+ */
+double roll_stats_chi_squared(const roll_stats_t *stats, int *dof);
+
+// P(X >= x) for X chi-squared distributed with dof degrees of freedom
+double chi_squared_p_value(double x, int dof);
+
+#endif // ROLL_LOG_H
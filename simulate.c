@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "dice.h"
+#include "dice_expr.h"
+#include "simulate.h"
+
+/**
+ * Trials per chunk. Each chunk has its own generator stream, so this
+ * is also the granularity at which work is split between threads.
+ */
+#define DICE_SIM_CHUNK (1 << 16)
+// threads that run simulations, counting the one that asked for it
+#define DICE_SIM_THREADS_MAX 64
+
+// a histogram that widens itself to fit whatever totals come up
+typedef struct sim_tally {
+  long long min;
+  size_t len; // 0 until the first total is added
+  uint64_t *counts;
+} sim_tally_t;
+
+// makes room for total in t; returns -1 if the range would get too wide
+static int tally_grow(sim_tally_t *t, long long total) {
+  long long lo = t->len ? t->min : total;
+  long long hi = t->len ? t->min + (long long) (t->len - 1) : total;
+  int growing_down = total < lo;
+  if (total < lo) lo = total;
+  if (total > hi) hi = total;
+  uint64_t span = (uint64_t) hi - (uint64_t) lo + 1;
+  if (span == 0 || span > DICE_SIM_SPAN_MAX) return -1;
+
+  // leave as much room again on the side that grew, so growing is rare
+  long long slack = span / 2;
+  if (span + slack > DICE_SIM_SPAN_MAX) slack = DICE_SIM_SPAN_MAX - span;
+  if (growing_down) {
+    if (__builtin_sub_overflow(lo, slack, &lo)) slack = 0;
+  } else {
+    if (__builtin_add_overflow(hi, slack, &hi)) slack = 0;
+  }
+  span += slack;
+
+  uint64_t *counts = calloc(span, sizeof(uint64_t));
+  if (counts == NULL) return -1;
+  if (t->len) {
+    memcpy(
+      counts + ((uint64_t) t->min - (uint64_t) lo),
+      t->counts,
+      t->len * sizeof(uint64_t)
+    );
+  }
+  free(t->counts);
+  t->counts = counts;
+  t->min = lo;
+  t->len = span;
+  return 0;
+}
+
+static inline int tally_add(sim_tally_t *t, long long total) {
+  uint64_t i = (uint64_t) total - (uint64_t) t->min;
+  if (i >= t->len) {
+    if (tally_grow(t, total)) return -1;
+    i = (uint64_t) total - (uint64_t) t->min;
+  }
+  t->counts[i]++;
+  return 0;
+}
+
+typedef struct sim_worker {
+  const dice_program_t *program;
+  dice_rng_t rng; // positioned at the start of first_chunk's stream
+  uint64_t first_chunk, chunk_stride, trials;
+  atomic_int *failed; // shared; set by the first worker to fail
+  sim_tally_t tally;
+  const char *err;
+} sim_worker_t;
+
+static void sim_worker_run(sim_worker_t *w) {
+  for (uint64_t chunk = w->first_chunk;
+       chunk * DICE_SIM_CHUNK < w->trials;
+       chunk += w->chunk_stride) {
+    dice_rng_t rng = w->rng;
+    uint64_t end = (chunk + 1) * DICE_SIM_CHUNK;
+    if (end > w->trials) end = w->trials;
+    for (uint64_t i = chunk * DICE_SIM_CHUNK; i < end; i++) {
+      diceroll_t roll;
+      w->err = dice_program_eval(w->program, &rng, &roll);
+      if (w->err == NULL && tally_add(&w->tally, roll.value)) {
+        w->err = "That roll has too many different totals to tally.";
+      }
+      if (w->err != NULL) {
+        atomic_store(w->failed, 1);
+        return;
+      }
+    }
+    if (atomic_load(w->failed)) return;
+    for (uint64_t j = 0; j < w->chunk_stride; j++) dice_rng_jump(&w->rng);
+  }
+}
+
+/**
+ * The simulation pool: threads started the first time anything is
+ * simulated and kept for the life of the process, so simulations share
+ * a fixed set of threads however many of them run at once. A
+ * simulation queues a job whose workers are claimed one at a time by
+ * the pool and by the thread that called dice_simulate(), which runs
+ * workers too instead of just waiting.
+ * ===================================================================
+ */
+typedef struct sim_job {
+  sim_worker_t *workers;
+  size_t worker_ct;
+  size_t claimed, finished;
+  struct sim_job *next;
+} sim_job_t;
+
+static struct {
+  pthread_once_t once;
+  pthread_mutex_t lock; // guards everything below and every queued job
+  pthread_cond_t queued; // signaled when a job is queued
+  pthread_cond_t finished; // broadcast when a worker finishes
+  sim_job_t *head, *tail; // jobs with workers left to claim
+  size_t thread_ct;
+} pool = {
+  .once = PTHREAD_ONCE_INIT,
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .queued = PTHREAD_COND_INITIALIZER,
+  .finished = PTHREAD_COND_INITIALIZER
+};
+
+/**
+ * Claims the next worker of job, which must be queued, and takes the
+ * job out of the queue once none are left. Must be called with
+ * pool.lock held.
+ */
+static sim_worker_t *claim_worker_locked(sim_job_t *job) {
+  sim_worker_t *w = job->workers + job->claimed++;
+  if (job->claimed == job->worker_ct) {
+    sim_job_t **link = &pool.head, *prev = NULL;
+    while (*link != job) {
+      prev = *link;
+      link = &prev->next;
+    }
+    *link = job->next;
+    if (pool.tail == job) pool.tail = prev;
+  }
+  return w;
+}
+
+static void finish_worker(sim_job_t *job) {
+  pthread_mutex_lock(&pool.lock);
+  if (++job->finished == job->worker_ct) {
+    pthread_cond_broadcast(&pool.finished);
+  }
+  pthread_mutex_unlock(&pool.lock);
+}
+
+static void *sim_pool_main(void *arg) {
+  for (;;) {
+    pthread_mutex_lock(&pool.lock);
+    while (pool.head == NULL) pthread_cond_wait(&pool.queued, &pool.lock);
+    sim_job_t *job = pool.head;
+    sim_worker_t *w = claim_worker_locked(job);
+    pthread_mutex_unlock(&pool.lock);
+    sim_worker_run(w);
+    finish_worker(job);
+  }
+  return NULL;
+}
+
+// one thread per core besides the caller's, up to DICE_SIM_THREADS_MAX
+static void start_sim_pool(void) {
+  long cpu_ct = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t want = cpu_ct > 1 ? cpu_ct - 1 : 0;
+  if (want > DICE_SIM_THREADS_MAX - 1) want = DICE_SIM_THREADS_MAX - 1;
+  for (size_t i = 0; i < want; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, sim_pool_main, NULL)) break;
+    pthread_detach(thread);
+    pool.thread_ct++;
+  }
+}
+
+// runs every worker of job on the pool and this thread, and waits for them
+static void run_on_pool(sim_job_t *job) {
+  pthread_mutex_lock(&pool.lock);
+  if (pool.tail != NULL) pool.tail->next = job;
+  else pool.head = job;
+  pool.tail = job;
+  for (size_t i = 1; i < job->worker_ct; i++) {
+    pthread_cond_signal(&pool.queued);
+  }
+  // a job stays queued until all of its workers are claimed
+  while (job->claimed < job->worker_ct) {
+    sim_worker_t *w = claim_worker_locked(job);
+    pthread_mutex_unlock(&pool.lock);
+    sim_worker_run(w);
+    pthread_mutex_lock(&pool.lock);
+    job->finished++;
+  }
+  while (job->finished < job->worker_ct) {
+    pthread_cond_wait(&pool.finished, &pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+}
+
+// adds every worker's tally into *out, trimmed to the totals that came up
+static const char *merge_tallies(
+  sim_worker_t *workers,
+  size_t worker_ct,
+  dice_sim_t *out
+) {
+  long long lo = 0, hi = 0;
+  int any = 0;
+  for (size_t i = 0; i < worker_ct; i++) {
+    const sim_tally_t *t = &workers[i].tally;
+    size_t first = 0, last = t->len;
+    while (first < last && t->counts[first] == 0) first++;
+    while (last > first && t->counts[last - 1] == 0) last--;
+    if (first == last) continue;
+    long long t_lo = t->min + (long long) first;
+    long long t_hi = t->min + (long long) (last - 1);
+    if (!any || t_lo < lo) lo = t_lo;
+    if (!any || t_hi > hi) hi = t_hi;
+    any = 1;
+  }
+  uint64_t span = (uint64_t) hi - (uint64_t) lo + 1;
+  if (!any) return "No trials were run.";
+  if (span > DICE_SIM_SPAN_MAX) {
+    return "That roll has too many different totals to tally.";
+  }
+  out->min = lo;
+  out->len = span;
+  out->counts = calloc(span, sizeof(uint64_t));
+  if (out->counts == NULL) return "Memory allocation error";
+  for (size_t i = 0; i < worker_ct; i++) {
+    const sim_tally_t *t = &workers[i].tally;
+    for (size_t j = 0; j < t->len; j++) {
+      if (t->counts[j]) {
+        out->counts[(uint64_t) (t->min + (long long) j) - (uint64_t) lo] +=
+          t->counts[j];
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * How many dice one evaluation of program rolls, which is what a trial
+ * costs. A term of more than DICE_EXACT_MAX dice costs no more than
+ * one of DICE_EXACT_MAX (see dice_sum()), and exploded dice aren't
+ * counted. At least 1, so that trials of a constant still count.
+ */
+static uint64_t dice_per_trial(const dice_program_t *program) {
+  uint64_t dice_ct = 0;
+  for (int i = 0; i < program->term_ct; i++) {
+    int count = program->terms[i].count;
+    if (count > 0) dice_ct += count < DICE_EXACT_MAX ? count : DICE_EXACT_MAX;
+  }
+  return dice_ct ? dice_ct : 1;
+}
+
+const char *dice_simulate(
+  const dice_program_t *program,
+  uint64_t trials,
+  uint64_t seed,
+  dice_sim_t *out
+) {
+  memset(out, 0, sizeof(dice_sim_t));
+  if (trials == 0) return "Simulate at least one trial.";
+  if (trials > DICE_SIM_TRIALS_MAX) {
+    return "That's too many trials; the most is 10000000.";
+  }
+  if (trials * dice_per_trial(program) > DICE_SIM_DICE_MAX) {
+    return "That's too many dice to simulate; the trials times the dice "
+      "in each trial can be at most 100000000.";
+  }
+
+  pthread_once(&pool.once, start_sim_pool);
+  uint64_t chunk_ct = (trials + DICE_SIM_CHUNK - 1) / DICE_SIM_CHUNK;
+  size_t worker_ct = pool.thread_ct + 1;
+  if (worker_ct > chunk_ct) worker_ct = chunk_ct;
+  sim_worker_t *workers = calloc(worker_ct, sizeof(sim_worker_t));
+  if (workers == NULL) return "Memory allocation error";
+
+  atomic_int failed = 0;
+  dice_rng_t stream;
+  dice_rng_seed(&stream, seed);
+  for (size_t i = 0; i < worker_ct; i++) {
+    workers[i] = (sim_worker_t){
+      .program = program,
+      .rng = stream,
+      .first_chunk = i,
+      .chunk_stride = worker_ct,
+      .trials = trials,
+      .failed = &failed
+    };
+    dice_rng_jump(&stream);
+  }
+  sim_job_t job = { .workers = workers, .worker_ct = worker_ct };
+  run_on_pool(&job);
+
+  const char *err = NULL;
+  for (size_t i = 0; i < worker_ct && err == NULL; i++) err = workers[i].err;
+  if (err == NULL) err = merge_tallies(workers, worker_ct, out);
+  for (size_t i = 0; i < worker_ct; i++) free(workers[i].tally.counts);
+  free(workers);
+  if (err != NULL) {
+    dice_sim_free(out);
+    return err;
+  }
+  out->trials = trials;
+  return NULL;
+}
+
+void dice_sim_free(dice_sim_t *sim) {
+  free(sim->counts);
+  sim->counts = NULL;
+  sim->len = 0;
+}
+
+double dice_sim_mean(const dice_sim_t *sim) {
+  double sum = 0;
+  for (size_t i = 0; i < sim->len; i++) sum += (double) i * sim->counts[i];
+  return sim->min + sum / sim->trials;
+}
+
+double dice_sim_stddev(const dice_sim_t *sim) {
+  double mean = dice_sim_mean(sim) - sim->min;
+  double sum = 0;
+  for (size_t i = 0; i < sim->len; i++) {
+    sum += (i - mean) * (i - mean) * sim->counts[i];
+  }
+  return sqrt(sum / sim->trials);
+}
+
+long long dice_sim_percentile(const dice_sim_t *sim, double fraction) {
+  uint64_t needed = ceil(fraction * sim->trials);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < sim->len; i++) {
+    seen += sim->counts[i];
+    if (seen >= needed) return sim->min + (long long) i;
+  }
+  return sim->min + (long long) sim->len - 1;
+}
@@ -0,0 +1,52 @@
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dice_expr.h"
+
+#define DICE_SIM_TRIALS_MAX 10000000
+// most dice one simulation may roll: trials times the dice in each trial
+#define DICE_SIM_DICE_MAX 100000000
+// widest range of totals that will be tallied
+#define DICE_SIM_SPAN_MAX (1 << 20)
+
+/**
+ * How often each total came up in a simulation: counts[i] trials
+ * totaled min + i, for i in [0, len).
+ */
+typedef struct dice_sim {
+  uint64_t trials;
+  long long min;
+  size_t len;
+  uint64_t *counts; // heap-allocated
+} dice_sim_t;
+
+/**
+ * Evaluates program `trials` times and tallies the totals into *out.
+ * The work is spread over the calling thread and a pool of up to one
+ * thread per core that's shared by every simulation, so simulations
+ * running at once don't add threads. The trials are cut into
+ * fixed-size chunks, and chunk k rolls on the generator seeded with
+ * `seed` and then jumped k times (see dice_rng_jump()), so the same
+ * seed always gives the same tally no matter how many threads ran.
+ * Simulations that would roll more than DICE_SIM_DICE_MAX dice are
+ * refused. Returns NULL on success or an error message (a string
+ * literal); on success the caller must dice_sim_free() *out.
+ */
+const char *dice_simulate(
+  const dice_program_t *program,
+  uint64_t trials,
+  uint64_t seed,
+  dice_sim_t *out
+);
+
+void dice_sim_free(dice_sim_t *sim);
+
+double dice_sim_mean(const dice_sim_t *sim);
+double dice_sim_stddev(const dice_sim_t *sim);
+
+// smallest total t such that at least fraction of the trials were <= t
+long long dice_sim_percentile(const dice_sim_t *sim, double fraction);
+
+#endif // SIMULATE_H
@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "stats.h"
+
+/**
+ * Log-linear (HDR-style) latency buckets: values below 16ns get a
+ * bucket each, and every power of 2 above that is split into 16
+ * equal sub-buckets, so a bucket is never wider than 1/16 of the
+ * values it holds. Anything at or above 2^STATS_MAX_EXP ns (about 18
+ * minutes) lands in the last bucket.
+ */
+#define STATS_SUB_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXP 40
+#define STATS_BUCKETS ((STATS_MAX_EXP - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+typedef struct command_stats {
+  atomic_uint_fast64_t calls;
+  atomic_uint_fast64_t errors;
+  atomic_uint_fast64_t total_ns;
+  atomic_uint_fast64_t max_ns;
+  atomic_uint_fast64_t buckets[STATS_BUCKETS];
+} command_stats_t;
+
+static command_stats_t stats[STAT_ID_CT];
+
+static const char *const stat_names[STAT_ID_CT] = {
+  [STAT_COMMANDS] = "%commands",
+  [STAT_CMDINFO] = "%cmdinfo",
+  [STAT_REVERSE] = "%reverse",
+  [STAT_ROLL] = "%roll",
+  [STAT_REROLL] = "%reroll",
+  [STAT_ODDS] = "%odds",
+  [STAT_SIMULATE] = "%simulate",
+  [STAT_ROLLSTATS] = "%rollstats",
+  [STAT_CALCMOD] = "%calcmod",
+  [STAT_DND] = "%dnd",
+  [STAT_DND_QUERY] = "%dnd query",
+  [STAT_DND_WTF] = "%dnd wtf",
+  [STAT_STATS] = "%stats",
+  [STAT_UNRECOGNIZED] = "(unrecognized)",
+};
+
+static size_t bucket_index(uint64_t ns) {
+  if (ns < STATS_SUB_BUCKETS) return ns;
+  int exp = 63 - __builtin_clzll(ns);
+  if (exp >= STATS_MAX_EXP) return STATS_BUCKETS - 1;
+  size_t sub = (ns >> (exp - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1);
+  return (size_t) (exp - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS + sub;
+}
+
+// largest value that bucket_index() maps to index
+static uint64_t bucket_upper(size_t index) {
+  if (index < STATS_SUB_BUCKETS) return index;
+  int exp = index / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+  uint64_t sub = index % STATS_SUB_BUCKETS;
+  uint64_t width = (uint64_t) 1 << (exp - STATS_SUB_BITS);
+  return ((STATS_SUB_BUCKETS + sub) << (exp - STATS_SUB_BITS)) + width - 1;
+}
+
+uint64_t stats_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000U + ts.tv_nsec;
+}
+
+void stats_record(stat_id_t id, uint64_t elapsed_ns, int failed) {
+  command_stats_t *s = stats + id;
+  atomic_fetch_add_explicit(&s->calls, 1, memory_order_relaxed);
+  if (failed) atomic_fetch_add_explicit(&s->errors, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&s->total_ns, elapsed_ns, memory_order_relaxed);
+  atomic_fetch_add_explicit(
+    s->buckets + bucket_index(elapsed_ns), 1, memory_order_relaxed
+  );
+  uint_fast64_t max = atomic_load_explicit(&s->max_ns, memory_order_relaxed);
+  while (elapsed_ns > max && !atomic_compare_exchange_weak_explicit(
+    &s->max_ns, &max, elapsed_ns,
+    memory_order_relaxed, memory_order_relaxed
+  ));
+}
+
+// fills in the percentiles of *dest from a copy of the buckets
+static void compute_percentiles(
+  stats_snapshot_t *dest,
+  const uint64_t *buckets
+) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < STATS_BUCKETS; i++) total += buckets[i];
+
+  const double fractions[] = { 0.50, 0.90, 0.99 };
+  uint64_t *results[] = { &dest->p50_ns, &dest->p90_ns, &dest->p99_ns };
+  uint64_t seen = 0;
+  size_t i = 0;
+  for (int p = 0; p < 3; p++) {
+    // the smallest value that at least this many calls didn't exceed
+    uint64_t rank = (uint64_t) (fractions[p] * total + 0.999999);
+    if (rank == 0) rank = 1;
+    while (i < STATS_BUCKETS && seen + buckets[i] < rank) seen += buckets[i++];
+    uint64_t value = i < STATS_BUCKETS ? bucket_upper(i) : 0;
+    *results[p] = value < dest->max_ns ? value : dest->max_ns;
+  }
+}
+
+size_t get_command_stats(stats_snapshot_t *out, size_t max) {
+  size_t n = max < STAT_ID_CT ? max : STAT_ID_CT;
+  for (size_t id = 0; id < n; id++) {
+    const command_stats_t *s = stats + id;
+    uint64_t buckets[STATS_BUCKETS];
+    for (size_t i = 0; i < STATS_BUCKETS; i++) {
+      buckets[i] = atomic_load_explicit(s->buckets + i, memory_order_relaxed);
+    }
+    out[id] = (stats_snapshot_t){
+      .name = stat_names[id],
+      .calls = atomic_load_explicit(&s->calls, memory_order_relaxed),
+      .errors = atomic_load_explicit(&s->errors, memory_order_relaxed),
+      .total_ns = atomic_load_explicit(&s->total_ns, memory_order_relaxed),
+      .max_ns = atomic_load_explicit(&s->max_ns, memory_order_relaxed)
+    };
+    compute_percentiles(out + id, buckets);
+  }
+  return n;
+}
@@ -0,0 +1,59 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * One set of counters per dispatched command and per `%dnd`
+ * subcommand. When adding a command, add its id here, its name to
+ * stat_names in stats.c, and its id to its entry in gen_dispatch.py.
+ */
+typedef enum stat_id {
+  STAT_COMMANDS,
+  STAT_CMDINFO,
+  STAT_REVERSE,
+  STAT_ROLL,
+  STAT_REROLL,
+  STAT_ODDS,
+  STAT_SIMULATE,
+  STAT_ROLLSTATS,
+  STAT_CALCMOD,
+  STAT_DND,
+  STAT_DND_QUERY,
+  STAT_DND_WTF,
+  STAT_STATS,
+  STAT_UNRECOGNIZED, // messages that didn't name any command
+  STAT_ID_CT
+} stat_id_t;
+
+typedef struct stats_snapshot {
+  const char *name; // e.g. "%roll" or "%dnd query"
+  uint64_t calls;
+  uint64_t errors; // calls whose reply was an error message
+  uint64_t total_ns;
+  uint64_t max_ns;
+  // percentiles are accurate to within 1/16 (6.25%) of their value
+  uint64_t p50_ns;
+  uint64_t p90_ns;
+  uint64_t p99_ns;
+} stats_snapshot_t;
+
+// nanoseconds from a monotonic clock, for timing a call to record
+uint64_t stats_now_ns(void);
+
+/**
+ * Adds one call that took elapsed_ns to the counters for id. Never
+ * blocks and never allocates, so it's safe to call from any thread.
+ */
+void stats_record(stat_id_t id, uint64_t elapsed_ns, int failed);
+
+/**
+ * Copies the counters for up to max stat ids (STAT_ID_CT covers all
+ * of them), in stat_id_t order, into out and returns how many were
+ * copied. Counters keep changing while this reads them, so the
+ * fields of one snapshot can disagree by a call or two.
+ */
+size_t get_command_stats(stats_snapshot_t *out, size_t max);
+
+#endif // STATS_H
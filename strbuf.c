@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "strbuf.h"
+
+#define STRBUF_MIN_CAP 64
+
+void strbuf_init(strbuf_t *sb) {
+  sb->data = NULL;
+  sb->len = 0;
+  sb->cap = 0;
+}
+
+int strbuf_reserve(strbuf_t *sb, size_t extra) {
+  size_t needed = sb->len + extra + 1;
+  if (needed <= sb->cap) return 0;
+  size_t new_cap = sb->cap ? sb->cap : STRBUF_MIN_CAP;
+  while (new_cap < needed) new_cap *= 2;
+  char *grown = realloc(sb->data, new_cap);
+  if (grown == NULL) {
+    fprintf(stderr, "Memory allocation error\n");
+    return -1;
+  }
+  sb->data = grown;
+  sb->cap = new_cap;
+  return 0;
+}
+
+int strbuf_append(strbuf_t *sb, const char *str, size_t len) {
+  if (strbuf_reserve(sb, len)) return -1;
+  memcpy(sb->data + sb->len, str, len);
+  sb->len += len;
+  sb->data[sb->len] = '\0';
+  return 0;
+}
+
+int strbuf_puts(strbuf_t *sb, const char *str) {
+  return strbuf_append(sb, str, strlen(str));
+}
+
+int strbuf_putc(strbuf_t *sb, char c) {
+  return strbuf_append(sb, &c, 1);
+}
+
+/**
+ * Formats straight into the spare capacity. The format string is only
+ * processed a second time in the rare case that the output didn't fit.
+ */
+int strbuf_printf(strbuf_t *sb, const char *fmt, ...) {
+  if (strbuf_reserve(sb, STRBUF_MIN_CAP)) return -1;
+  size_t room = sb->cap - sb->len;
+  va_list args;
+  va_start(args, fmt);
+  int written = vsnprintf(sb->data + sb->len, room, fmt, args);
+  va_end(args);
+  if (written < 0) {
+    sb->data[sb->len] = '\0';
+    return -1;
+  }
+  if ((size_t) written >= room) {
+    if (strbuf_reserve(sb, written)) {
+      sb->data[sb->len] = '\0';
+      return -1;
+    }
+    va_start(args, fmt);
+    vsnprintf(sb->data + sb->len, written + 1, fmt, args);
+    va_end(args);
+  }
+  sb->len += written;
+  return 0;
+}
+
+// "00" through "99", so two digits are converted per division
+static const char digit_pairs[201] =
+  "00010203040506070809101112131415161718192021222324"
+  "25262728293031323334353637383940414243444546474849"
+  "50515253545556575859606162636465666768697071727374"
+  "75767778798081828384858687888990919293949596979899";
+
+// number of decimal digits in value
+static int digit_ct(unsigned long long value) {
+  int n = 1;
+  for (; value >= 10000; value /= 10000) n += 4;
+  if (value >= 1000) return n + 3;
+  if (value >= 100) return n + 2;
+  if (value >= 10) return n + 1;
+  return n;
+}
+
+// writes value in decimal at sb's end; the sign, if any, is already there
+static int append_digits(strbuf_t *sb, unsigned long long value, int sign_len) {
+  int len = digit_ct(value);
+  if (strbuf_reserve(sb, sign_len + len)) return -1;
+  char *pos = sb->data + sb->len + sign_len + len;
+  *pos = '\0';
+  while (value >= 100) {
+    const char *pair = digit_pairs + value % 100 * 2;
+    value /= 100;
+    *--pos = pair[1];
+    *--pos = pair[0];
+  }
+  if (value >= 10) {
+    *--pos = digit_pairs[value * 2 + 1];
+    *--pos = digit_pairs[value * 2];
+  } else {
+    *--pos = '0' + value;
+  }
+  if (sign_len) *--pos = '-';
+  sb->len += sign_len + len;
+  return 0;
+}
+
+int strbuf_append_int(strbuf_t *sb, long long value) {
+  // negate as unsigned, so LLONG_MIN doesn't overflow
+  if (value < 0) return append_digits(sb, -(unsigned long long) value, 1);
+  return append_digits(sb, value, 0);
+}
+
+int strbuf_append_uint(strbuf_t *sb, unsigned long long value) {
+  return append_digits(sb, value, 0);
+}
+
+int strbuf_concat(strbuf_t *sb, ...) {
+  va_list args;
+  size_t total = 0;
+  va_start(args, sb);
+  for (const char *str; (str = va_arg(args, const char *)) != NULL; )
+    total += strlen(str);
+  va_end(args);
+  if (strbuf_reserve(sb, total)) return -1;
+  va_start(args, sb);
+  for (const char *str; (str = va_arg(args, const char *)) != NULL; ) {
+    size_t len = strlen(str);
+    memcpy(sb->data + sb->len, str, len);
+    sb->len += len;
+  }
+  va_end(args);
+  sb->data[sb->len] = '\0';
+  return 0;
+}
+
+void strbuf_clear(strbuf_t *sb) {
+  sb->len = 0;
+  if (sb->data != NULL) sb->data[0] = '\0';
+}
+
+char *strbuf_detach(strbuf_t *sb) {
+  char *result = sb->data;
+  if (result == NULL) result = calloc(1, 1);
+  strbuf_init(sb);
+  return result;
+}
+
+void strbuf_free(strbuf_t *sb) {
+  free(sb->data);
+  strbuf_init(sb);
+}
@@ -0,0 +1,68 @@
+#ifndef STRBUF_H
+#define STRBUF_H
+
+#include <stddef.h>
+
+/**
+ * A growable, length-tracking output buffer. Its capacity grows
+ * geometrically and is kept when the buffer is cleared, so a buffer
+ * that's reused for many replies stops allocating once it's as big
+ * as the biggest reply. A zero-initialized strbuf_t is empty and
+ * valid, which lets callers (including ctypes) declare one without
+ * calling any function.
+ */
+typedef struct strbuf {
+  char *data; // heap-allocated; '\0'-terminated whenever len > 0
+  size_t len; // number of chars in data, not counting the final '\0'
+  size_t cap; // number of chars allocated for data
+} strbuf_t;
+
+void strbuf_init(strbuf_t *sb);
+
+/**
+ * Makes sure `extra` more chars (plus a '\0') fit without another
+ * allocation. Returns 0 on success and -1 if memory ran out, in
+ * which case *sb is left as it was.
+ */
+int strbuf_reserve(strbuf_t *sb, size_t extra);
+
+// these return 0 on success and -1 if memory ran out
+int strbuf_append(strbuf_t *sb, const char *str, size_t len);
+int strbuf_puts(strbuf_t *sb, const char *str);
+int strbuf_putc(strbuf_t *sb, char c);
+int strbuf_printf(strbuf_t *sb, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+/**
+ * Fragment appenders, for building replies without printf. Each one
+ * writes its piece straight into the spare capacity, once; integers
+ * are converted two digits at a time from a lookup table instead of
+ * through a format string.
+ * ===================================================================
+ */
+
+// appends value in decimal
+int strbuf_append_int(strbuf_t *sb, long long value);
+int strbuf_append_uint(strbuf_t *sb, unsigned long long value);
+
+// appends a string literal; its length is known at compile time
+#define strbuf_put_lit(sb, lit) strbuf_append((sb), "" lit, sizeof(lit) - 1)
+
+/**
+ * Appends the concatenation of the NULL-terminated list of strings
+ * after sb, growing the buffer at most once, e.g.
+ * strbuf_concat(out, "**", sheet, "** ", field, ": ", NULL).
+ */
+int strbuf_concat(strbuf_t *sb, ...) __attribute__((sentinel));
+
+// empties *sb but keeps its memory for reuse
+void strbuf_clear(strbuf_t *sb);
+
+/**
+ * Hands the contents of *sb to the caller as a heap-allocated string
+ * (which is never NULL unless memory ran out) and leaves *sb empty.
+ */
+char *strbuf_detach(strbuf_t *sb);
+
+void strbuf_free(strbuf_t *sb);
+
+#endif // STRBUF_H
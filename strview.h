@@ -0,0 +1,16 @@
+#ifndef STRVIEW_H
+#define STRVIEW_H
+
+#include <stddef.h>
+
+/**
+ * A non-owning view of `len` chars starting at `ptr`. The views that
+ * handle_message() passes to the `cmd_*` functions as `margv` are also
+ * '\0'-terminated, so `ptr` can be used as a C string.
+ */
+typedef struct strview {
+  const char *ptr;
+  size_t len;
+} strview_t;
+
+#endif // STRVIEW_H
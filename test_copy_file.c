@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "copy_file.h"
+
+/*
+ (after main.py has compiled copy_file.o)
+ gcc test_copy_file.c copy_file.o -o test-copy-file.x86 -Wall -std=gnu11
+ ./test-copy-file.x86 [directory on another filesystem]
+
+ Copies a file with copy_file() within one temporary directory under
+ /tmp, then into one under the given directory (/dev/shm by default),
+ which if it's on another filesystem makes copy_file_range() fail and
+ the copy fall back to the next method. Then copies from a missing
+ source, over a directory (which fails at the rename) and into a
+ directory that can't be written to, all of which must fail and leave
+ the old destination alone. After each copy it
+ checks the destination's contents and permissions and that no
+ temporary file was left behind. Prints each failed check and exits
+ with status 1 if there were any.
+ */
+
+// more than one read(2)/write(2) buffer, and not a multiple of it
+#define DATA_SIZE (3 * 0x4000 + 123)
+
+static int failures = 0;
+
+static void check(int ok, const char *what, const char *path) {
+  if (ok) return;
+  fprintf(stderr, "FAIL: %s (%s)\n", what, path);
+  failures++;
+}
+
+static int write_file(const char *path, const char *data, size_t size) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) return -1;
+  int failed = write(fd, data, size) != (ssize_t) size;
+  return close(fd) || failed ? -1 : 0;
+}
+
+// whether path holds exactly size bytes of data
+static int has_contents(const char *path, const char *data, size_t size) {
+  static char buf[DATA_SIZE + 1];
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return 0;
+  ssize_t n = read(fd, buf, sizeof(buf));
+  close(fd);
+  return n == (ssize_t) size && !memcmp(buf, data, size);
+}
+
+// whether dir holds a temporary file for name (name.XXXXXX)
+static int has_temp_file(const char *dir, const char *name) {
+  DIR *d = opendir(dir);
+  if (d == NULL) return 1;
+  size_t len = strlen(name);
+  int found = 0;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    if (strncmp(e->d_name, name, len) || e->d_name[len] != '.') continue;
+    fprintf(stderr, "temporary file left behind: %s/%s\n", dir, e->d_name);
+    found = 1;
+  }
+  closedir(d);
+  return found;
+}
+
+// copies src_path to dest_dir/copy and checks that it worked
+static void check_copy(
+  const char *src_path,
+  const char *dest_dir,
+  const char *data
+) {
+  char dest_path[4096];
+  snprintf(dest_path, sizeof(dest_path), "%s/copy", dest_dir);
+  check(
+    copy_file(src_path, dest_path) == DATA_SIZE,
+    "copy_file() returns the size", dest_path
+  );
+  check(
+    has_contents(dest_path, data, DATA_SIZE),
+    "the copy has the source's contents", dest_path
+  );
+  struct stat st;
+  check(
+    !stat(dest_path, &st) && (st.st_mode & 07777) == 0640,
+    "the copy has the source's permissions", dest_path
+  );
+  check(
+    !has_temp_file(dest_dir, "copy"),
+    "no temporary file is left behind", dest_dir
+  );
+}
+
+/**
+ * Copies into a directory this process can't write to, dropping root
+ * first (in a child, since it can't be undone) because root can write
+ * anywhere. Returns what copy_file() returned, or -2 if the test
+ * couldn't run.
+ */
+static ssize_t copy_unprivileged(const char *src_path, const char *dest_path) {
+  pid_t pid = fork();
+  if (pid < 0) return -2;
+  if (pid == 0) {
+    if (geteuid() == 0 && (setgid(65534) || setuid(65534))) _exit(2);
+    _exit(copy_file(src_path, dest_path) < 0 ? 1 : 0);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) return -2;
+  switch (WEXITSTATUS(status)) {
+    case 0: return DATA_SIZE;
+    case 1: return -1;
+    default: return -2;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *other_fs = argc > 1 ? argv[1] : "/dev/shm";
+  static char data[DATA_SIZE];
+  for (size_t i = 0; i < DATA_SIZE; i++) data[i] = i * 7 + i / 251;
+
+  char dir[] = "/tmp/test-copy-file-XXXXXX";
+  char other_dir[1024], src_path[64], missing_path[64], subdir_path[64];
+  char dest_path[4096], locked_dir[64], locked_path[64];
+  snprintf(other_dir, sizeof(other_dir), "%s/test-copy-file-XXXXXX", other_fs);
+  if (mkdtemp(dir) == NULL || mkdtemp(other_dir) == NULL) {
+    fprintf(stderr, "Unable to make the temporary directories\n");
+    return 1;
+  }
+  snprintf(src_path, sizeof(src_path), "%s/source", dir);
+  snprintf(missing_path, sizeof(missing_path), "%s/missing", dir);
+  snprintf(dest_path, sizeof(dest_path), "%s/copy", dir);
+  snprintf(subdir_path, sizeof(subdir_path), "%s/subdir", dir);
+  snprintf(locked_dir, sizeof(locked_dir), "%s/locked", dir);
+  snprintf(locked_path, sizeof(locked_path), "%s/locked/copy", dir);
+  if (write_file(src_path, data, DATA_SIZE) || chmod(src_path, 0640)) {
+    fprintf(stderr, "Unable to write `%s`\n", src_path);
+    return 1;
+  }
+
+  // same filesystem, then (probably) another one
+  check_copy(src_path, dir, data);
+  struct stat here, there;
+  if (!stat(dir, &here) && !stat(other_dir, &there)
+      && here.st_dev == there.st_dev) {
+    fprintf(stderr, "note: `%s` is on the same filesystem as /tmp\n", other_fs);
+  }
+  check_copy(src_path, other_dir, data);
+
+  // a missing source fails and leaves the old copy alone
+  check(
+    copy_file(missing_path, dest_path) == -1,
+    "copying a missing source fails", missing_path
+  );
+  check(
+    has_contents(dest_path, data, DATA_SIZE),
+    "a failed copy leaves the old copy alone", dest_path
+  );
+  check(
+    !has_temp_file(dir, "copy"),
+    "a failed copy leaves no temporary file", dir
+  );
+
+  // a destination that's a directory fails only at the rename, after
+  // the temporary file was written, which must still be removed
+  if (mkdir(subdir_path, 0700)) {
+    fprintf(stderr, "Unable to make `%s`\n", subdir_path);
+    failures++;
+  } else {
+    check(
+      copy_file(src_path, subdir_path) == -1,
+      "copying over a directory fails", subdir_path
+    );
+    check(
+      !has_temp_file(dir, "subdir"),
+      "a failed rename leaves no temporary file", dir
+    );
+    rmdir(subdir_path);
+  }
+
+  // so does a destination directory that can't be written to; the
+  // source must stay readable once root is dropped
+  if (mkdir(locked_dir, 0700) || write_file(locked_path, "old", 3)
+      || chmod(locked_dir, 0555) || chmod(dir, 0755)
+      || chmod(src_path, 0644)) {
+    fprintf(stderr, "Unable to set up `%s`\n", locked_dir);
+    failures++;
+  } else {
+    ssize_t copied = copy_unprivileged(src_path, locked_path);
+    if (copied == -2) {
+      fprintf(stderr, "note: skipped the unwritable directory test\n");
+    } else {
+      check(
+        copied == -1,
+        "copying into an unwritable directory fails", locked_path
+      );
+    }
+    check(
+      has_contents(locked_path, "old", 3),
+      "a failed copy leaves the old file alone", locked_path
+    );
+    check(
+      !has_temp_file(locked_dir, "copy"),
+      "a failed copy leaves no temporary file", locked_dir
+    );
+    chmod(locked_dir, 0700);
+    unlink(locked_path);
+    rmdir(locked_dir);
+  }
+
+  unlink(dest_path);
+  unlink(src_path);
+  rmdir(dir);
+  snprintf(dest_path, sizeof(dest_path), "%s/copy", other_dir);
+  unlink(dest_path);
+  rmdir(other_dir);
+
+  if (failures) {
+    fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("all copy_file() checks passed\n");
+  return 0;
+}
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "dice.h"
+#include "dice_expr.h"
+#include "odds.h"
+#include "simulate.h"
+#include "roll_log.h"
+#include "last_roll.h"
+
+/*
+ (after main.py has compiled the backend's object files)
+ gcc test_dice.c dice.o dice_kernel.o dice_expr.o odds.o simulate.o \
+   roll_log.o last_roll.o strbuf.o -o test-dice.x86 -Wall -std=gnu11 \
+   -lm -lpthread
+ ./test-dice.x86
+
+ Deterministic checks of the dice modules: what the expression
+ compiler makes of a few expressions and that a seeded roll repeats,
+ exact odds that can be worked out by hand, that a seeded simulation
+ repeats and agrees with those odds, the roll log's chi-squared
+ fairness test on hand-made tallies, and that the last roll table
+ survives a restart (by running itself again). The roll log and last
+ roll table are kept in a temporary directory, never the bot's own.
+ Prints each failed check and exits with status 1 if there were any.
+ */
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+      printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while (0)
+
+static int near(double x, double y, double tolerance) {
+  return fabs(x - y) <= tolerance;
+}
+
+/**
+ * Scratch state, as in the benchmarks: set before either module is
+ * first used, and removed after the last roll table's exit-time flush.
+ * ===================================================================
+ */
+static char state_dir[] = "/tmp/test-dice-XXXXXX";
+static char last_roll_path[sizeof(state_dir) + 32];
+static char last_roll_tmp_path[sizeof(state_dir) + 32];
+static char roll_log_path[sizeof(state_dir) + 32];
+
+static void remove_state_dir(void) {
+  unlink(last_roll_path);
+  unlink(last_roll_tmp_path);
+  unlink(roll_log_path);
+  rmdir(state_dir);
+}
+
+static int use_scratch_state(void) {
+  if (mkdtemp(state_dir) == NULL) return -1;
+  snprintf(
+    last_roll_path, sizeof(last_roll_path), "%s/lastrolls.bin", state_dir
+  );
+  snprintf(
+    last_roll_tmp_path, sizeof(last_roll_tmp_path),
+    "%s/lastrolls.bin.tmp", state_dir
+  );
+  snprintf(roll_log_path, sizeof(roll_log_path), "%s/rolllog.bin", state_dir);
+  atexit(remove_state_dir);
+  if (setenv(LAST_ROLL_PATH_ENV, last_roll_path, 1)
+      || setenv(ROLL_LOG_PATH_ENV, roll_log_path, 1)) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * The checks, one function per module.
+ * ===================================================================
+ */
+static void check_dice_expr(void) {
+  dice_program_t program;
+  CHECK(dice_expr_compile("(3D8+2d6-1)*2", &program) == NULL);
+  CHECK(!strcmp(program.text, "(3d8+2d6-1)*2"));
+  CHECK(program.term_ct == 2);
+  CHECK(program.terms[0].count == 3 && program.terms[0].faces == 8);
+  CHECK(program.terms[1].count == 2 && program.terms[1].faces == 6);
+
+  CHECK(dice_expr_compile("4d6kh3", &program) == NULL);
+  CHECK(program.terms[0].keep_mode == DICE_KEEP_HIGHEST);
+  CHECK(program.terms[0].keep == 3);
+  CHECK(dice_expr_compile("d20", &program) == NULL);
+  CHECK(program.terms[0].count == 1 && program.terms[0].faces == 20);
+
+  CHECK(dice_expr_compile("", &program) != NULL);
+  CHECK(dice_expr_compile("3d", &program) != NULL);
+  CHECK(dice_expr_compile("2d6+", &program) != NULL);
+  CHECK(dice_expr_compile("(1d6", &program) != NULL);
+
+  // no dice: always the same total
+  diceroll_t roll;
+  dice_rng_t rng;
+  dice_rng_seed(&rng, 1);
+  CHECK(dice_expr_compile("2*(3+4)-1", &program) == NULL);
+  CHECK(dice_program_eval(&program, &rng, &roll) == NULL);
+  CHECK(roll.value == 13);
+
+  // the same seed rolls the same dice, and every total is in range
+  CHECK(dice_expr_compile("4d6kh3+1d6!", &program) == NULL);
+  dice_rng_t again;
+  dice_rng_seed(&rng, 42);
+  dice_rng_seed(&again, 42);
+  for (int i = 0; i < 1000; i++) {
+    diceroll_t other;
+    long long terms[DICE_PROGRAM_TERMS_MAX];
+    CHECK(dice_program_eval_terms(&program, &rng, &roll, terms) == NULL);
+    CHECK(dice_program_eval(&program, &again, &other) == NULL);
+    CHECK(roll.value == other.value);
+    CHECK(terms[0] >= 3 && terms[0] <= 18 && terms[1] >= 1);
+    CHECK(roll.value == terms[0] + terms[1]);
+  }
+}
+
+static void check_odds(void) {
+  dice_program_t program;
+  dice_dist_t dist;
+  CHECK(dice_expr_compile("1d20", &program) == NULL);
+  CHECK(dice_program_dist(&program, &dist) == NULL);
+  CHECK(near(dice_dist_at_least(&dist, 15), 6 / 20.0, 1e-12));
+  CHECK(near(dice_dist_mean(&dist), 10.5, 1e-12));
+  dice_dist_free(&dist);
+
+  CHECK(dice_expr_compile("2d6", &program) == NULL);
+  CHECK(dice_program_dist(&program, &dist) == NULL);
+  CHECK(dist.offset == 2 && dist.len == 11);
+  CHECK(near(dice_dist_at_least(&dist, 7), 21 / 36.0, 1e-12));
+  CHECK(near(dice_dist_at_least(&dist, 12), 1 / 36.0, 1e-12));
+  CHECK(near(dice_dist_mean(&dist), 7, 1e-12));
+  CHECK(near(dice_dist_stddev(&dist), sqrt(35 / 6.0), 1e-9));
+  CHECK(dice_dist_percentile(&dist, 0.5) == 7);
+  dice_dist_free(&dist);
+
+  CHECK(dice_expr_compile("2d6-1d4", &program) == NULL);
+  CHECK(dice_program_dist(&program, &dist) == NULL);
+  CHECK(dist.offset == -2 && dist.len == 14);
+  CHECK(near(dice_dist_mean(&dist), 4.5, 1e-12));
+  dice_dist_free(&dist);
+
+  // keep/drop and exploding dice have no exact distribution here
+  CHECK(dice_expr_compile("4d6kh3", &program) == NULL);
+  CHECK(dice_program_dist(&program, &dist) != NULL);
+}
+
+static void check_simulate(void) {
+  const uint64_t trials = 360000;
+  dice_program_t program;
+  dice_sim_t sim, again;
+  CHECK(dice_expr_compile("2d6", &program) == NULL);
+  CHECK(dice_simulate(&program, trials, 42, &sim) == NULL);
+  CHECK(dice_simulate(&program, trials, 42, &again) == NULL);
+  CHECK(sim.trials == trials && sim.min == 2 && sim.len == 11);
+  CHECK(again.len == sim.len);
+  CHECK(!memcmp(sim.counts, again.counts, sim.len * sizeof(uint64_t)));
+
+  // every total turns up about as often as the odds say
+  uint64_t tallied = 0;
+  for (size_t i = 0; i < sim.len; i++) {
+    double expected = (6 - fabs(i + 2 - 7.0)) / 36;
+    CHECK(near((double) sim.counts[i] / trials, expected, 0.003));
+    tallied += sim.counts[i];
+  }
+  CHECK(tallied == trials);
+  CHECK(near(dice_sim_mean(&sim), 7, 0.02));
+  dice_sim_free(&sim);
+  dice_sim_free(&again);
+
+  // over the budget: 4000 dice a trial, 100000 trials
+  CHECK(dice_expr_compile("4000d6", &program) == NULL);
+  CHECK(dice_simulate(&program, 100000, 1, &sim) != NULL);
+}
+
+static void check_roll_log(void) {
+  // P(X >= x) is exactly e^(-x/2) with 2 degrees of freedom
+  CHECK(near(chi_squared_p_value(2, 2), exp(-1), 1e-9));
+  CHECK(near(chi_squared_p_value(3.841459, 1), 0.05, 1e-6));
+  CHECK(near(chi_squared_p_value(11.0705, 5), 0.05, 1e-5));
+  CHECK(chi_squared_p_value(0, 5) == 1);
+
+  roll_stats_t stats[4];
+  int dof;
+  memset(stats, 0, sizeof(stats[0]));
+  stats[0].faces = 6;
+  stats[0].singles = 29; // fewer than 5 per face
+  CHECK(roll_stats_chi_squared(stats, &dof) == -1);
+
+  // user 7 rolls every face of a d6 10 times; user 8 never rolls a 6
+  dice_program_t program;
+  long long fair[60], skewed[60];
+  for (int i = 0; i < 60; i++) {
+    fair[i] = i % 6 + 1;
+    skewed[i] = i < 20 ? 1 : i % 4 + 2;
+  }
+  CHECK(dice_expr_compile("1d6", &program) == NULL);
+  roll_log_record(7, 1, &program, fair, 60);
+  roll_log_record(8, 1, &program, skewed, 60);
+  // kept or exploding dice are logged but left out of the stats
+  CHECK(dice_expr_compile("4d6kh3", &program) == NULL);
+  roll_log_record(7, 1, &program, fair, 1);
+
+  CHECK(roll_stats_get(7, stats, 4) == 1);
+  CHECK(stats[0].faces == 6 && stats[0].dice == 60 && stats[0].singles == 60);
+  CHECK(stats[0].sum == 210);
+  for (int f = 0; f < 6; f++) CHECK(stats[0].hist[f] == 10);
+  CHECK(roll_stats_chi_squared(stats, &dof) == 0 && dof == 5);
+
+  CHECK(roll_stats_get(8, stats, 4) == 1);
+  CHECK(stats[0].hist[0] == 20 && stats[0].hist[5] == 0);
+  CHECK(near(roll_stats_chi_squared(stats, &dof), 20, 1e-9) && dof == 5);
+  CHECK(chi_squared_p_value(20, dof) < 0.01);
+
+  CHECK(roll_stats_get(ROLL_STATS_ALL_USERS, stats, 4) == 1);
+  CHECK(stats[0].dice == 120 && stats[0].hist[0] == 30);
+  CHECK(roll_stats_get(9, stats, 4) == 0);
+}
+
+static void check_last_roll(const char *self) {
+  char spec[LAST_ROLL_SPEC_MAX], long_spec[LAST_ROLL_SPEC_MAX + 10];
+  CHECK(last_roll_get(1, 2, spec) == -1);
+  last_roll_put(1, 2, "1d20+3 2x2d6");
+  CHECK(last_roll_get(1, 2, spec) == 0 && !strcmp(spec, "1d20+3 2x2d6"));
+  CHECK(last_roll_get(2, 1, spec) == -1);
+
+  memset(long_spec, 'x', sizeof(long_spec) - 1);
+  long_spec[sizeof(long_spec) - 1] = '\0';
+  last_roll_put(3, 4, long_spec);
+  CHECK(last_roll_get(3, 4, spec) == 0);
+  CHECK(strlen(spec) == LAST_ROLL_SPEC_MAX - 1);
+
+  // a new process loads what this one wrote
+  CHECK(last_roll_flush() == 0);
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "%s --reload", self);
+  CHECK(system(cmd) == 0);
+}
+
+// run as `--reload` by check_last_roll(), with the same environment
+static int check_reloaded(void) {
+  char spec[LAST_ROLL_SPEC_MAX];
+  CHECK(last_roll_get(1, 2, spec) == 0 && !strcmp(spec, "1d20+3 2x2d6"));
+  CHECK(last_roll_get(3, 4, spec) == 0);
+  CHECK(strlen(spec) == LAST_ROLL_SPEC_MAX - 1);
+  return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1 && !strcmp(argv[1], "--reload")) return check_reloaded();
+  if (use_scratch_state()) {
+    fprintf(stderr, "Unable to make a scratch state directory\n");
+    return 1;
+  }
+  check_dice_expr();
+  check_odds();
+  check_simulate();
+  check_roll_log();
+  check_last_roll(argv[0]);
+  printf("%d checks failed\n", failures);
+  return failures ? 1 : 0;
+}
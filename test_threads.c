@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "tryptobot.h"
+
+/*
+ (after main.py has compiled the *.o files)
+ gcc test_threads.c tryptobot.c dndml/dnd_input_reader.o \
+   dndml/dnd_lexer.o dndml/dnd_charsheet.o dndml/dnd_parser.o \
+   charsheet_utils.o copy_file.o command_catalog.o strbuf.o stats.o \
+   dice.o dice_kernel.o dice_expr.o odds.o last_roll.o simulate.o \
+   roll_log.o charsheet_cache.o utf8_reverse.o file_cache.o \
+   -o test-threads.x86 -Wall -std=gnu11 -lm -lpthread
+ ./test-threads.x86 [max threads] [messages per thread]
+
+ Hammers handle_message() from 1, 2, 4, ... up to [max threads]
+ threads at once, checks every reply against the one produced by a
+ single thread, and prints the throughput for each thread count.
+ Must be run from the root of the repo (so charsheets/ is found).
+ */
+
+static const char *test_msgs[] = {
+  "%reverse the quick brown fox jumps over the lazy dog",
+  "%reverse Ipswich",
+  "%reverse h\303\251llo \360\237\221\215\360\237\217\275 w\303\266rld",
+  "%calcmod 13",
+  "%cmdinfo %roll",
+  "%commands",
+  "%dnd query shookspeared skills",
+  "%dnd query shookspeared personal-stats hitdice",
+  "%bogus command",
+};
+#define TEST_MSG_CT (sizeof(test_msgs) / sizeof(test_msgs[0]))
+
+// `%roll` is random, so its replies are only checked for their prefix;
+// 100 dice is enough to go through dice_fill()'s vector kernels
+static const char *roll_msg = "%roll 100d6+2";
+static const char *roll_prefix = "Result of rolling 100d6+2: ";
+
+static char *expected[TEST_MSG_CT];
+
+typedef struct worker_arg {
+  int msg_ct;
+  int mismatches;
+} worker_arg_t;
+
+static void *worker(void *arg) {
+  worker_arg_t *w = arg;
+  for (int i = 0; i < w->msg_ct; i++) {
+    char *reply;
+    if (i % (TEST_MSG_CT + 1) == TEST_MSG_CT) {
+      reply = handle_message(roll_msg);
+      if (strncmp(reply, roll_prefix, strlen(roll_prefix))) w->mismatches++;
+    } else {
+      int m = i % (TEST_MSG_CT + 1);
+      reply = handle_message(test_msgs[m]);
+      if (strcmp(reply, expected[m])) w->mismatches++;
+    }
+    free(reply);
+  }
+  return NULL;
+}
+
+static double now_secs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+  int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+  int msgs_per_thread = argc > 2 ? atoi(argv[2]) : 2000;
+
+  for (int m = 0; m < TEST_MSG_CT; m++) {
+    expected[m] = handle_message(test_msgs[m]);
+  }
+
+  int failed = 0;
+  double base_rate = 0;
+  for (int thread_ct = 1; thread_ct <= max_threads; thread_ct *= 2) {
+    pthread_t *threads = malloc(thread_ct * sizeof(pthread_t));
+    worker_arg_t *args = malloc(thread_ct * sizeof(worker_arg_t));
+    double start = now_secs();
+    for (int t = 0; t < thread_ct; t++) {
+      args[t] = (worker_arg_t){ .msg_ct = msgs_per_thread, .mismatches = 0 };
+      pthread_create(threads + t, NULL, worker, args + t);
+    }
+    int mismatches = 0;
+    for (int t = 0; t < thread_ct; t++) {
+      pthread_join(threads[t], NULL);
+      mismatches += args[t].mismatches;
+    }
+    double elapsed = now_secs() - start;
+    double rate = thread_ct * msgs_per_thread / elapsed;
+    if (thread_ct == 1) base_rate = rate;
+    printf(
+      "threads: %2d; msgs/sec: %10.0f; speedup: %5.2fx; mismatches: %d\n",
+      thread_ct, rate, rate / base_rate, mismatches
+    );
+    if (mismatches) failed = 1;
+    free(threads);
+    free(args);
+  }
+
+  for (int m = 0; m < TEST_MSG_CT; m++) free(expected[m]);
+  return failed;
+}
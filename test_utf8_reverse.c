@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+#include "utf8_reverse.h"
+
+/*
+ (after main.py has compiled utf8_reverse.o)
+ gcc test_utf8_reverse.c utf8_reverse.o -o test-utf8-reverse.x86 -Wall \
+   -std=gnu11 -lpthread
+ ./test-utf8-reverse.x86
+
+ Reverses each test string with utf8_reverse() and checks the result
+ against the expected one, which is the string's grapheme clusters
+ (as Perl's \X finds them) in reverse order, or for invalid UTF-8 its
+ bytes one at a time. Prints each mismatch and exits with status 1 if
+ there were any.
+ */
+
+static const struct {
+  const char *name, *text, *reversed;
+} cases[] = {
+  { "ASCII", "hello, world", "dlrow ,olleh" },
+  { "combining accent", "cafe\314\201 ok", "ko e\314\201fac" },
+  {
+    "ZWJ emoji",
+    "a\360\237\221\250\342\200\215\360\237\221\251\342\200\215\360\237\221"
+    "\247b",
+    "b\360\237\221\250\342\200\215\360\237\221\251\342\200\215\360\237\221"
+    "\247a"
+  },
+  {
+    "ZWJ emoji with a variation selector",
+    "x\342\235\244\357\270\217\342\200\215\360\237\224\245y",
+    "y\342\235\244\357\270\217\342\200\215\360\237\224\245x"
+  },
+  {
+    "flags",
+    "\360\237\207\272\360\237\207\270\360\237\207\253\360\237\207\267",
+    "\360\237\207\253\360\237\207\267\360\237\207\272\360\237\207\270"
+  },
+  {
+    "odd number of regional indicators",
+    "\360\237\207\272\360\237\207\270\360\237\207\253",
+    "\360\237\207\253\360\237\207\272\360\237\207\270"
+  },
+  {
+    "skin tones",
+    "ok \360\237\221\215\360\237\217\275\360\237\221\213\360\237\217\277",
+    "\360\237\221\213\360\237\217\277\360\237\221\215\360\237\217\275 ko"
+  },
+  {
+    "precomposed Hangul",
+    "\355\225\234\352\265\255\354\226\264",
+    "\354\226\264\352\265\255\355\225\234"
+  },
+  {
+    "Hangul jamo",
+    "\341\204\222\341\205\241\341\206\253\341\204\200\341\205\256\341\206\250",
+    "\341\204\200\341\205\256\341\206\250\341\204\222\341\205\241\341\206\253"
+  },
+  { "CRLF", "one\r\ntwo\n\rthree", "eerht\r\nowt\r\neno" },
+  {
+    // a stray byte, a truncated sequence, an overlong form, a surrogate
+    "invalid bytes",
+    "a\377\303b\342\202x\300\257\355\240\200z",
+    "z\200\240\355\257\300x\202\342b\303\377a"
+  },
+  {
+    "ASCII long enough for the vector kernels, then emoji",
+    "the quick brown fox jumps over the lazy dog, twice: the quick brown "
+    "fox \360\237\221\215\360\237\217\275!",
+    "!\360\237\221\215\360\237\217\275 xof nworb kciuq eht :eciwt ,god "
+    "yzal eht revo spmuj xof nworb kciuq eht"
+  },
+  {
+    "CRLF and an accent inside vector blocks",
+    "0123456789abcdef0123456789\r\nabcdef0123456789abcde\314\201f"
+    "0123456789abcdef0123456789abcdef",
+    "fedcba9876543210fedcba9876543210fe\314\201dcba9876543210fedcba\r\n"
+    "9876543210fedcba9876543210"
+  },
+};
+#define CASE_CT (sizeof(cases) / sizeof(cases[0]))
+
+int main(void) {
+  int failures = 0;
+  for (size_t i = 0; i < CASE_CT; i++) {
+    char out[256];
+    size_t len = strlen(cases[i].text);
+    utf8_reverse(out, cases[i].text, len);
+    out[len] = '\0';
+    if (strcmp(out, cases[i].reversed)) {
+      printf("%s: got \"%s\", expected \"%s\"\n",
+        cases[i].name, out, cases[i].reversed);
+      failures++;
+    }
+  }
+  printf("%zu cases, %d failed\n", CASE_CT, failures);
+  return failures ? 1 : 0;
+}
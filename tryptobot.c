@@ -4,489 +4,657 @@
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
 #include "tryptobot.h"
-#include "jsmn.h"
-#include "dstrcat.h"
 #include "dndml/dnd_input_reader.h"
 #include "dndml/dnd_charsheet.h"
 #include "dndml/dnd_lexer.h"
 #include "dndml/dnd_parser.h"
 #include "charsheet_utils.h"
+#include "charsheet_cache.h"
+#include "command_catalog.h"
+#include "strview.h"
+#include "strbuf.h"
+#include "stats.h"
 #include "dice.h"
-
-// copied from here https://stackoverflow.com/a/19674312
-static unsigned char *utf8_reverse(const unsigned char *str, int size) {
-  unsigned char *ret = calloc(size, sizeof(unsigned char));
-  int ret_size = 0;
-  int pos = size - 2;
-  int char_size = 0;
-
-  if (str == NULL) {
-    fprintf(stderr, "failed to allocate memory.\n");
-    return NULL;
-  }
-
-  while (pos > -1) {
-
-    if (str[pos] < 0x80) {
-      char_size = 1;
-    } else if (pos > 0 && str[pos - 1] > 0xC1 && str[pos - 1] < 0xE0) {
-      char_size = 2;
-    } else if (pos > 1 && str[pos - 2] > 0xDF && str[pos - 2] < 0xF0) {
-      char_size = 3;
-    } else if (pos > 2 && str[pos - 3] > 0xEF && str[pos - 3] < 0xF5) {
-      char_size = 4;
-    } else {
-      char_size = 1;
-    }
-
-    pos -= char_size;
-    memcpy(ret + ret_size, str + pos + 1, char_size);
-    ret_size += char_size;
+#include "dice_expr.h"
+#include "odds.h"
+#include "last_roll.h"
+#include "simulate.h"
+#include "roll_log.h"
+#include "utf8_reverse.h"
+
+static int cmd_commands(
+  int margc,
+  const strview_t *margv,
+  const char *msg,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
+) {
+  const command_catalog_t *catalog = acquire_command_catalog();
+  if (catalog == NULL) {
+    strbuf_puts(out, "Backend error");
+    return -1;
   }
-
-  ret[ret_size] = '\0';
-
-  return ret;
+  strbuf_append(out, catalog->listing, catalog->listing_len);
+  release_command_catalog(catalog);
+  return 0;
 }
 
-typedef struct command {
-  char *command;
-  char *syntax;
-  char *description;
-} command_t;
-
-typedef struct command_vec {
-  size_t size;
-  command_t *commands;
-} command_vec_t;
-
-// frees the MEMBERS of *command, NOT command itself
-static void free_command_t_members(command_t *command) {
-  free(command->command);
-  free(command->syntax);
-  free(command->description);
-}
-
-// transfers ownership of passed pointers to *dest
-static void create_command(
-  command_t *dest,
-  char *command,
-  char *syntax,
-  char *description
+static int cmd_cmdinfo(
+  int margc,
+  const strview_t *margv,
+  const char *msg,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
 ) {
-  dest->command = command;
-  dest->syntax = syntax;
-  dest->description = description;
+  if (margc < 2) {
+    strbuf_puts(
+      out,
+      "Error: no command specified. "
+      "Syntax is `%cmdinfo <command>`."
+    );
+    return -1;
+  }
+  const char *queried_command = margv[1].ptr;
+  const command_catalog_t *catalog = acquire_command_catalog();
+  if (catalog == NULL) {
+    strbuf_puts(out, "Backend error");
+    return -1;
+  }
+  const command_t *result_command = find_command(catalog, queried_command);
+  if (result_command == NULL) {
+    strbuf_printf(
+      out,
+      "Unable to find info for command `%s`. "
+      "Did you forget to include a leading '%%'?",
+      queried_command
+    );
+    release_command_catalog(catalog);
+    return -1;
+  }
+  strbuf_append(out, result_command->info, result_command->info_len);
+  release_command_catalog(catalog);
+  return 0;
 }
 
-// number of tokens is stored in *token_ct
-static jsmntok_t *json_tokenize(char *json_string, int *token_ct) {
-  jsmn_parser p;
-  jsmn_init(&p);
-  int json_len = strlen(json_string);
-  *token_ct = jsmn_parse(&p, json_string, json_len, NULL, INT_MAX);
-  jsmntok_t *tokens = malloc(*token_ct * sizeof(jsmntok_t));
-  jsmn_init(&p); // do not delete this line!
-  *token_ct = jsmn_parse(
-    &p,
-    json_string,
-    json_len,
-    tokens,
-    *token_ct
-  );
-
-  if (*token_ct < 0) {
-    switch (*token_ct) {
-      case JSMN_ERROR_INVAL:
-        fprintf(stderr, "Invalid JSON: %s\n", json_string);
-      break;
-      case JSMN_ERROR_NOMEM:
-        fprintf(stderr, "JSON too large, allocate more memory!\n");
-      break;
-      case JSMN_ERROR_PART:
-        fprintf(stderr, "JSON is too short: %s\n", json_string);
-      break;
-      default:
-        fprintf(stderr, "Failed to parse JSON: %d\n", *token_ct);
+static int cmd_reverse(
+  int margc,
+  const strview_t *margv,
+  const char *msg, // should be pointer passed to handle_message as msg
+  const msg_ctx_t *ctx,
+  strbuf_t *out
+) {
+  if (margc == 2 && !strcmp(margv[1].ptr, "Ipswich")) {
+    strbuf_puts(out, "Bolton");
+  } else if (margc == 2 && !strcmp(margv[1].ptr, "ipswich")) {
+    strbuf_puts(out, "bolton");
+  } else {
+    // skip past "%reverse" and the spaces around it
+    const char *msg_ptr = msg;
+    while (*msg_ptr == ' ') msg_ptr++;
+    msg_ptr += margv[0].len;
+    while (*msg_ptr == ' ') msg_ptr++;
+    size_t len = strlen(msg_ptr);
+    if (strbuf_reserve(out, len)) {
+      strbuf_puts(out, "Memory allocation error");
+      return -1;
     }
-    return NULL;
+    utf8_reverse(out->data + out->len, msg_ptr, len);
+    out->len += len;
+    out->data[out->len] = '\0';
   }
+  return 0;
+}
 
-  /* Assume the top-level element is an object */
-  if (*token_ct < 1 || tokens[0].type != JSMN_OBJECT) {
-    fprintf(stderr, "Object expected\n");
-    return NULL;
+// the total, then each dice term's subtotal if there's more than one
+static void put_diceroll_result(strbuf_t *out, const diceroll_t *diceroll) {
+  strbuf_concat(out, "Result of rolling ", diceroll->expr, ": ", NULL);
+  strbuf_append_int(out, diceroll->value);
+  if (diceroll->term_ct > 1) {
+    int shown = diceroll->term_ct < DICE_TERMS_MAX ?
+                diceroll->term_ct : DICE_TERMS_MAX;
+    strbuf_put_lit(out, " (");
+    for (int i = 0; i < shown; i++) {
+      const dice_term_total_t *term = diceroll->terms + i;
+      if (i) strbuf_put_lit(out, ", ");
+      strbuf_append(
+        out,
+        diceroll->expr + term->label_start, term->label_len
+      );
+      strbuf_put_lit(out, ": ");
+      strbuf_append_int(out, term->value);
+    }
+    strbuf_puts(out, diceroll->term_ct > shown ? ", ...)" : ")");
   }
-
-  return tokens;
 }
 
-char *load_file_to_str(const char *filename) {
-  FILE *f = fopen(filename, "rb");
-  char *result;
-  if (f) {
-    fseek(f, 0, SEEK_END);
-    long length = ftell(f);
-    int x;
-    fseek(f, 0, SEEK_SET);
-    result = malloc(length+1);
-    if (result) {
-      x = fread(result, 1, length, f);
-      result[x] = '\0';
-    } else {
-      fprintf(stderr, "Memory allocation error\n");
-      fclose(f);
-      return NULL;
-    }
-  } else {
-    fprintf(stderr, "Unable to find `%s`\n", filename);
-    return NULL;
+// most rolls one `%roll` may make, counting each repeat of `<n>x<expr>`
+#define ROLLS_PER_MESSAGE_MAX 100
+
+/**
+* Splits a `%roll` argument of the form `<n>x<expr>` (roll expr n
+* times) into n and expr; expr is empty if the argument is just `<n>x`.
+* Anything else is rolled once. Returns the repeat count, or -1 if
+* it's out of range.
+* ==================================================================
+*/
+static int parse_repeat(const char *arg, const char **expr) {
+  const char *pos = arg;
+  long long count = 0;
+  while (*pos >= '0' && *pos <= '9' && count <= ROLLS_PER_MESSAGE_MAX) {
+    count = count * 10 + (*pos++ - '0');
   }
-  fclose(f);
-  return result;
+  if (pos == arg || (*pos != 'x' && *pos != 'X')) {
+    *expr = arg;
+    return 1;
+  }
+  *expr = pos + 1;
+  return count >= 1 && count <= ROLLS_PER_MESSAGE_MAX ? count : -1;
 }
 
-static command_vec_t *load_commands(void) {
-  char *json_string = load_file_to_str(
-    "/home/runner/tryptobot/commands.json"
-  );
+// one thing `%roll` rolls, and how many times
+typedef struct roll_arg {
+  int repeats;
+  const char *expr;
+  // `<sheet> <section>.<field>` rolls expr from a character sheet
+  const char *sheet, *field; // NULL for a plain dice expression
+  char sheet_expr[CHARSHEET_EXPR_MAX];
+} roll_arg_t;
 
-  int token_ct;
-  jsmntok_t *tokens = json_tokenize(json_string, &token_ct);
+/**
+* Checks every argument in args, then rolls them all, appending one
+* line per roll to out. Once every roll has succeeded, they're all
+* logged for `%rollstats`; a reply that ends up an error logs none. An
+* argument followed by one of the form `<section>.<field>` names a
+* character sheet, and the pair rolls that field of the sheet. If an
+* argument is invalid, nothing is rolled and only the error is
+* appended. Returns -1 if the reply is an error and 0 otherwise.
+* ==================================================================
+*/
+static int roll_args(
+  int argc,
+  const strview_t *args,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
+) {
+  roll_arg_t rolls[ROLLS_PER_MESSAGE_MAX];
+  int arg_ct = 0, roll_ct = 0;
+  for (int i = 0; i < argc; i++) {
+    const char *expr;
+    int repeats = parse_repeat(args[i].ptr, &expr);
+    if (repeats < 0) {
+      strbuf_printf(
+        out,
+        "Error: `%s` must repeat its roll between 1 and %d times.",
+        args[i].ptr, ROLLS_PER_MESSAGE_MAX
+      );
+      return -1;
+    }
+    // `<n>x` on its own repeats whatever the next argument rolls
+    if (*expr == '\0') {
+      if (i + 1 == argc) {
+        strbuf_printf(out, "Error: Roll what %s?", args[i].ptr);
+        return -1;
+      }
+      expr = args[++i].ptr;
+    }
+    roll_ct += repeats;
+    if (roll_ct > ROLLS_PER_MESSAGE_MAX) {
+      strbuf_printf(
+        out,
+        "Error: That's too many rolls for one message; the most is %d.",
+        ROLLS_PER_MESSAGE_MAX
+      );
+      return -1;
+    }
+    // every argument rolls at least once, so this has room
+    roll_arg_t *roll = rolls + arg_ct++;
+    roll->repeats = repeats;
+    roll->expr = expr;
+    roll->sheet = roll->field = NULL;
+    if (i + 1 < argc && strchr(args[i + 1].ptr, '.') != NULL) {
+      roll->sheet = roll->expr;
+      roll->field = args[++i].ptr;
+      const char *err =
+        charsheet_roll_expr(roll->sheet, roll->field, roll->sheet_expr);
+      if (err != NULL) {
+        strbuf_printf(
+          out,
+          "Error: Can't roll `%s %s`. %s",
+          roll->sheet, roll->field, err
+        );
+        return -1;
+      }
+      roll->expr = roll->sheet_expr;
+    }
+    const char *err = NULL;
+    if (dice_expr_compile_cached(roll->expr, &err) == NULL) {
+      strbuf_printf(
+        out,
+        "Syntax error: `\"%s\"` is not valid dice notation. %s",
+        roll->expr, err
+      );
+      return -1;
+    }
+  }
 
-  // find the number of commands
-  int command_ct = 0;
-  char *json_array = strndup(
-    json_string + tokens[2].start,
-    tokens[2].end - tokens[2].start
-  );
-  for (int i = 0; json_array[i]; i++) {
-    if (json_array[i] == '{') command_ct++;
-  }
-  free(json_array);
-
-  // get the data from the JSON and return it
-  command_vec_t *result = malloc(sizeof(command_vec_t));
-  result->size = command_ct;
-  result->commands = malloc(result->size * sizeof(command_t));
-  for (int i = 0; i < command_ct; i++) {
-    create_command(
-      result->commands + i,
-      strndup(
-        json_string + tokens[5+7*i].start,
-        tokens[5+7*i].end - tokens[5+7*i].start
-      ),
-      strndup(
-        json_string + tokens[7+7*i].start,
-        tokens[7+7*i].end - tokens[7+7*i].start
-      ),
-      strndup(
-        json_string + tokens[9+7*i].start,
-        tokens[9+7*i].end - tokens[9+7*i].start
-      )
-    );
+  // every dice term's subtotal, logged only once the whole reply is built
+  long long term_values[ROLLS_PER_MESSAGE_MAX * DICE_PROGRAM_TERMS_MAX];
+  size_t value_ct = 0;
+  size_t reply_start = out->len;
+  for (int i = 0; i < arg_ct; i++) {
+    const roll_arg_t *roll = rolls + i;
+    // usually a hit in the compile cache, since it was just compiled
+    const char *err = NULL;
+    const dice_program_t *program = dice_expr_compile_cached(roll->expr, &err);
+
+    if (i > 0) strbuf_putc(out, '\n');
+    if (roll->sheet != NULL) {
+      strbuf_concat(out, "**", roll->sheet, "** ", roll->field, ": ", NULL);
+    }
+    if (roll->repeats > 1) {
+      strbuf_put_lit(out, "Results of rolling ");
+      strbuf_append_int(out, roll->repeats);
+      strbuf_concat(out, "x", program->text, ": ", NULL);
+    }
+    long long total = 0;
+    for (int r = 0; r < roll->repeats && err == NULL; r++) {
+      diceroll_t diceroll;
+      err = dice_program_eval_terms(
+        program, dice_thread_rng(), &diceroll, term_values + value_ct
+      );
+      if (err != NULL) break;
+      value_ct += program->term_ct;
+      if (roll->repeats == 1) {
+        put_diceroll_result(out, &diceroll);
+      } else {
+        if (r) strbuf_put_lit(out, ", ");
+        strbuf_append_int(out, diceroll.value);
+        if (__builtin_add_overflow(total, diceroll.value, &total)) {
+          err = "The result of that roll is too big.";
+        }
+      }
+    }
+    if (err != NULL) {
+      // take back the results so far, so the reply is just the error
+      out->len = reply_start;
+      strbuf_printf(out, "Error: %s", err);
+      return -1;
+    }
+    if (roll->repeats > 1) {
+      strbuf_put_lit(out, " (total ");
+      strbuf_append_int(out, total);
+      strbuf_putc(out, ')');
+    }
   }
-  free(tokens);
-  free(json_string);
-  return result;
-}
 
-static diceroll_t load_last_diceroll(void) {
-  char *last_diceroll_str = load_file_to_str(
-    "/home/runner/tryptobot/lastroll.txt"
-  );
-  if (last_diceroll_str) {
-    diceroll_t result;
-    sscanf(
-      last_diceroll_str,
-      "dice:%dd%d+%d;val:%d;",
-      &result.dice_ct, &result.faces, &result.modifier, &result.value
+  value_ct = 0;
+  for (int i = 0; i < arg_ct; i++) {
+    const char *err = NULL;
+    const dice_program_t *program =
+      dice_expr_compile_cached(rolls[i].expr, &err);
+    if (program == NULL) break;
+    roll_log_record(
+      ctx->user_id, ctx->channel_id,
+      program, term_values + value_ct, rolls[i].repeats
     );
-    return result;
-  } else {
-    fprintf(stderr, "Unable to read last dice roll\n");
-    return (diceroll_t){-1, -1, -1, -1};
+    value_ct += (size_t) rolls[i].repeats * program->term_ct;
   }
+  return 0;
 }
 
-static void save_diceroll(diceroll_t diceroll) {
-  FILE *f = fopen("/home/runner/tryptobot/lastroll.txt", "w+");
-  if (f) {
-    fprintf(
-      f, "dice:%dd%d+%d;val:%d;",
-      diceroll.dice_ct, diceroll.faces, diceroll.modifier, diceroll.value
-    );
-    fclose(f);
-  } else {
-    fprintf(stderr, "Unable to write to `lastroll.txt`\n");
+static int cmd_roll(
+  int margc,
+  const strview_t *margv,
+  const char *msg,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
+) {
+  if (margc < 2) {
+    strbuf_puts(out, "Error: Roll what?");
+    return -1;
   }
-}
 
-static int random_int(int min, int max) {
-  return rand() % (max - min + 1) + min;
-}
+  // the arguments, one space apart, are what %reroll rolls again
+  char spec[LAST_ROLL_SPEC_MAX];
+  size_t spec_len = 0;
+  for (int i = 1; i < margc; i++) {
+    if (spec_len + margv[i].len + 1 > sizeof(spec)) {
+      strbuf_printf(
+        out,
+        "Error: The arguments of one roll can be at most %d characters "
+        "long; use `<n>x<expression>` to repeat a roll.",
+        LAST_ROLL_SPEC_MAX - 1
+      );
+      return -1;
+    }
+    if (i > 1) spec[spec_len++] = ' ';
+    memcpy(spec + spec_len, margv[i].ptr, margv[i].len);
+    spec_len += margv[i].len;
+  }
+  spec[spec_len] = '\0';
 
-static diceroll_t roll_dice(int dice_ct, int faces, int modifier) {
-  diceroll_t result;
-  result.dice_ct = dice_ct;
-  result.faces = faces;
-  result.modifier = modifier;
-  result.value = 0;
-  for (int i = 0; i < dice_ct; i++) {
-    result.value += random_int(1, faces);
-  }
-  result.value += result.modifier;
-  return result;
+  if (roll_args(margc - 1, margv + 1, ctx, out)) return -1;
+  last_roll_put(ctx->user_id, ctx->channel_id, spec);
+  return 0;
 }
 
-static char *cmd_commands(int margc, char **margv) {
-  char *result;
-  command_vec_t *commands_vec = load_commands();
-  if (commands_vec == NULL) {
-    result = strdup("Backend error");
-    return result;
-  }
-  size_t result_len;
-  const char *result_start = "List of commands supported by tryptobot:\n";
-  result_len = strlen(result_start);
-  for (int i = 0; i < commands_vec->size; i++) {
-    result_len += snprintf(
-      NULL, 0,
-      "`%s`\n",
-      commands_vec->commands[i].command
-    );
+static int cmd_reroll(
+  int margc,
+  const strview_t *margv,
+  const char *msg,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
+) {
+  char spec[LAST_ROLL_SPEC_MAX];
+  if (last_roll_get(ctx->user_id, ctx->channel_id, spec)) {
+    strbuf_puts(out, "Error: You haven't rolled anything in this channel yet.");
+    return -1;
   }
-  const char *result_end = "For more info about a specific command, "
-                           "try `%cmdinfo <command>`.\n";
-  result_len += strlen(result_end);
-  result = malloc(result_len + 1);
-  strcpy(result, result_start);
-  for (int i = 0; i < commands_vec->size; i++) {
-    sprintf(
-      result + strlen(result),
-      "`%s`\n",
-      commands_vec->commands[i].command
-    );
+  // split the saved arguments back up, in place, skipping empty ones
+  strview_t args[LAST_ROLL_SPEC_MAX / 2];
+  int argc = 0;
+  for (char *pos = spec; *pos != '\0'; ) {
+    if (*pos == ' ') {
+      pos++;
+      continue;
+    }
+    if (argc == LAST_ROLL_SPEC_MAX / 2) break;
+    char *start = pos;
+    while (*pos != '\0' && *pos != ' ') pos++;
+    args[argc++] = (strview_t){ start, pos - start };
+    if (*pos == ' ') *pos++ = '\0';
+  }
+  if (argc == 0) {
+    strbuf_puts(out, "Error: You haven't rolled anything in this channel yet.");
+    return -1;
   }
-  strcat(result, result_end);
-  for (int i = 0; i < commands_vec->size; i++)
-    free_command_t_members(commands_vec->commands + i);
-  free(commands_vec->commands);
-  free(commands_vec);
-  return result;
+  return roll_args(argc, args, ctx, out);
 }
 
-static char *cmd_cmdinfo(int margc, char **margv) {
-  char *result;
-  if (margc < 2) {
-    result = strdup(
-      "Error: no command specified. "
-      "Syntax is `%cmdinfo <command>`."
-    );
-    return result;
-  }
-  const char *queried_command = margv[1];
-  command_vec_t *commands_vec = load_commands();
-  command_t *result_command = NULL; // non-owning pointer
-  for (int i = 0; i < commands_vec->size; i++) {
-    if (!strcmp(commands_vec->commands[i].command, queried_command)) {
-      result_command = commands_vec->commands + i;
-    }
-  }
-  if (result_command == NULL) {
-    const char *err_msg_start = "Unable to find info for command `";
-    const char *err_msg_end = "`. Did you forget to include a leading '%'?";
-    size_t result_len = snprintf(
-      NULL, 0,
-      "%s%s%s",
-      err_msg_start, queried_command, err_msg_end
-    );
-    result = malloc(result_len + 1);
-    sprintf(
-      result,
-      "%s%s%s",
-      err_msg_start, queried_command, err_msg_end
+// most die sizes `%rollstats` reports on
+#define ROLLSTATS_SIZES_MAX 32
+
+static void put_roll_stats(strbuf_t *out, const roll_stats_t *stats, int detail) {
+  strbuf_printf(
+    out,
+    "\nd%u: %llu dice, mean %.2f (a fair die averages %.2f)",
+    stats->faces, (unsigned long long) stats->dice,
+    (double) stats->sum / stats->dice, (stats->faces + 1) / 2.0
+  );
+  if (stats->faces < 2 || stats->faces > ROLL_STATS_HIST_FACES_MAX) return;
+  int dof;
+  double chi_squared = roll_stats_chi_squared(stats, &dof);
+  if (chi_squared < 0) {
+    strbuf_printf(
+      out,
+      "; %llu single rolls, too few for a fairness test (it needs %u)",
+      (unsigned long long) stats->singles, 5 * stats->faces
     );
   } else {
-    const char *result_pt_0 = "Command syntax: `";
-    const char *result_pt_1 = "`\nCommand description: ";
-    size_t result_len = snprintf(
-      NULL, 0,
-      "%s%s%s%s",
-      result_pt_0, result_command->syntax,
-      result_pt_1, result_command->description
-    );
-    result = malloc(result_len + 1);
-    sprintf(
-      result,
-      "%s%s%s%s",
-      result_pt_0, result_command->syntax,
-      result_pt_1, result_command->description
+    double p = chi_squared_p_value(chi_squared, dof);
+    strbuf_printf(
+      out,
+      "; over %llu single rolls, chi-squared is %.1f with %d degrees of "
+      "freedom, p = %.3g%s",
+      (unsigned long long) stats->singles, chi_squared, dof, p,
+      p < 0.01 ? " (suspiciously uneven)" : ""
     );
   }
-  for (int i = 0; i < commands_vec->size; i++)
-    free_command_t_members(commands_vec->commands + i);
-  free(commands_vec->commands);
-  free(commands_vec);
-  return result;
+  if (detail && stats->singles > 0) {
+    strbuf_puts(out, "\nSingle rolls by face:");
+    for (uint32_t f = 0; f < stats->faces; f++) {
+      strbuf_printf(
+        out,
+        "%s %u: %llu",
+        f ? "," : "", f + 1, (unsigned long long) stats->hist[f]
+      );
+    }
+  }
 }
 
-static char *cmd_reverse(
+static int cmd_rollstats(
   int margc,
-  char **margv,
-  const char *msg // should be pointer passed to handle_message as msg
+  const strview_t *margv,
+  const char *msg,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
 ) {
-  char *result;
-  if (margc == 2 && !strcmp(margv[1], "Ipswich")) {
-    result = strdup("Bolton");
-  } else if (margc == 2 && !strcmp(margv[1], "ipswich")) {
-    result = strdup("bolton");
-  } else {
-    char *msg_ptr = (char *) msg + 9; // 9 == strlen("%reverse ")
-    while (*msg_ptr == ' ') msg_ptr++;
-    result = utf8_reverse(msg_ptr, strlen(msg_ptr) + 1);
-    if (result == NULL) {
-      result = strdup("Memory allocation error");
+  int everyone = 0;
+  unsigned int only_faces = 0;
+  for (int i = 1; i < margc; i++) {
+    char extra;
+    if (!strcmp(margv[i].ptr, "all")) {
+      everyone = 1;
+    } else if (sscanf(margv[i].ptr, "d%u%c", &only_faces, &extra) != 1
+               || only_faces == 0) {
+      strbuf_puts(
+        out,
+        "Error: Syntax is `%rollstats [all] [d<faces>]`."
+      );
+      return -1;
     }
   }
-  return result;
+
+  roll_stats_t stats[ROLLSTATS_SIZES_MAX];
+  size_t stats_ct = roll_stats_get(
+    everyone ? ROLL_STATS_ALL_USERS : ctx->user_id,
+    stats, ROLLSTATS_SIZES_MAX
+  );
+  strbuf_printf(
+    out,
+    "%s in the roll log (which keeps the last %d dice terms anyone rolled):",
+    everyone ? "Everyone's rolls" : "Your rolls", ROLL_LOG_CAPACITY
+  );
+  int shown = 0;
+  for (size_t i = 0; i < stats_ct; i++) {
+    if (only_faces != 0 && stats[i].faces != only_faces) continue;
+    put_roll_stats(out, stats + i, only_faces != 0);
+    shown++;
+  }
+  if (shown == 0) strbuf_puts(out, "\nNothing yet.");
+  return 0;
 }
 
-/**
-* Checks if diceroll_str is valid dice syntax. If an
-* uppercase 'D' is present in diceroll_str,  it will
-* be replaced with a lowercase 'd',  hence why it is
-* passed  as  a  char *  instead of a  const char *.
-* Returns 1 if diceroll_str is valid, and 0 if it is
-* not.
-* ==================================================
-*/
-static int is_valid_diceroll_str(char *diceroll_str) {
-  int d_ct = 0; // number of instances of 'd' or 'D'
-  int plus_ct = 0; // number of instances of '+'
-  int result = 1;
-  for (int i = 0; diceroll_str[i]; i++) {
-    if (diceroll_str[i] == 'd') {
-      d_ct++;
-    } else if (diceroll_str[i] == 'D') {
-      diceroll_str[i] = 'd';
-      d_ct++;
-    } else if (diceroll_str[i] == '+') {
-      plus_ct++;
-    } else if (!isdigit(diceroll_str[i])) {
-      result = 0;
+static int cmd_odds(
+  int margc,
+  const strview_t *margv,
+  const char *msg,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
+) {
+  if (margc < 2) {
+    strbuf_puts(out, "Error: Work out the odds of what?");
+    return -1;
+  }
+
+  long long target = 0;
+  if (margc > 2) {
+    char *end;
+    errno = 0;
+    target = strtoll(margv[2].ptr, &end, 10);
+    if (end == margv[2].ptr || *end != '\0' || errno == ERANGE) {
+      strbuf_printf(out, "Error: `%s` is not a whole number.", margv[2].ptr);
+      return -1;
     }
   }
-  if (diceroll_str[0] == 'd') result = 0;
-  if (d_ct != 1) result = 0;
-  if (plus_ct > 1) result = 0;
-  return result;
-}
 
-static char *get_diceroll_result_str(diceroll_t diceroll) {
-  char *result;
-  if (diceroll.modifier) {
-    size_t result_len = snprintf(
-      NULL, 0,
-      "Result of rolling %dd%d+%d: %d",
-      diceroll.dice_ct, diceroll.faces, diceroll.modifier, diceroll.value
-    );
-    result = malloc(result_len+1);
-    sprintf(
-      result,
-      "Result of rolling %dd%d+%d: %d",
-      diceroll.dice_ct, diceroll.faces, diceroll.modifier, diceroll.value
-    );
-  } else {
-    size_t result_len = snprintf(
-      NULL, 0,
-      "Result of rolling %dd%d: %d",
-      diceroll.dice_ct, diceroll.faces, diceroll.value
+  const char *err = NULL;
+  const dice_program_t *program = dice_expr_compile_cached(margv[1].ptr, &err);
+  if (program == NULL) {
+    strbuf_printf(
+      out,
+      "Syntax error: `\"%s\"` is not valid dice notation. %s",
+      margv[1].ptr, err
     );
-    result = malloc(result_len+1);
-    sprintf(
-      result,
-      "Result of rolling %dd%d: %d",
-      diceroll.dice_ct, diceroll.faces, diceroll.value
+    return -1;
+  }
+  dice_dist_t dist;
+  err = dice_program_dist(program, &dist);
+  if (err != NULL) {
+    strbuf_printf(out, "Error: %s", err);
+    return -1;
+  }
+
+  strbuf_printf(
+    out,
+    "Distribution of `%s`: %lld to %lld, mean %.2f, standard deviation %.2f.\n"
+    "Percentiles: 10%%: %lld, 25%%: %lld, 50%%: %lld, 75%%: %lld, 90%%: %lld.",
+    program->text,
+    dist.offset, dist.offset + (long long) dist.len - 1,
+    dice_dist_mean(&dist), dice_dist_stddev(&dist),
+    dice_dist_percentile(&dist, 0.10), dice_dist_percentile(&dist, 0.25),
+    dice_dist_percentile(&dist, 0.50), dice_dist_percentile(&dist, 0.75),
+    dice_dist_percentile(&dist, 0.90)
+  );
+  if (margc > 2) {
+    strbuf_printf(
+      out,
+      "\nChance of rolling at least %lld: %.2f%%.",
+      target, 100 * dice_dist_at_least(&dist, target)
     );
   }
-  return result;
+  dice_dist_free(&dist);
+  return 0;
 }
 
-static char *cmd_roll(int margc, char **margv) {
-  char *result;
+#define SIMULATE_DEFAULT_TRIALS 100000
+#define HISTOGRAM_ROWS_MAX 20
+#define HISTOGRAM_BAR_WIDTH 30
+
+// a text histogram of sim in a code block, grouping totals if there are many
+static void put_histogram(strbuf_t *out, const dice_sim_t *sim) {
+  size_t bin_width = (sim->len + HISTOGRAM_ROWS_MAX - 1) / HISTOGRAM_ROWS_MAX;
+  size_t bin_ct = (sim->len + bin_width - 1) / bin_width;
+  uint64_t bins[HISTOGRAM_ROWS_MAX] = { 0 };
+  uint64_t max_bin = 0;
+  for (size_t i = 0; i < sim->len; i++) bins[i / bin_width] += sim->counts[i];
+  for (size_t b = 0; b < bin_ct; b++) {
+    if (bins[b] > max_bin) max_bin = bins[b];
+  }
 
-  if (margc < 2) {
-    result = strdup("Error: Roll what?");
-    return result;
+  char labels[HISTOGRAM_ROWS_MAX][48];
+  int label_width = 0;
+  for (size_t b = 0; b < bin_ct; b++) {
+    long long lo = sim->min + (long long) (b * bin_width);
+    long long hi = lo + (long long) bin_width - 1;
+    if (hi > sim->min + (long long) sim->len - 1) {
+      hi = sim->min + (long long) sim->len - 1;
+    }
+    int width = lo == hi ?
+      snprintf(labels[b], sizeof(labels[b]), "%lld", lo) :
+      snprintf(labels[b], sizeof(labels[b]), "%lld-%lld", lo, hi);
+    if (width > label_width) label_width = width;
   }
 
-  // check if the dice string is valid
-  if (!is_valid_diceroll_str(margv[1])) {
-    const char *err_msg = "Syntax error: `\"";
-    const char *err_msg_end = "\"` is not valid dice notation.";
-    size_t result_len = snprintf(
-      NULL, 0, "%s%s%s",
-      err_msg, margv[1], err_msg_end
-    );
-    result = malloc(result_len+1);
-    sprintf(result, "%s%s%s", err_msg, margv[1], err_msg_end);
-    return result;
-  }
-
-  // dice string has been validated, now we roll the dice
-  int dice_ct, faces, modifier;
-  int vals_scanned  = sscanf(margv[1], "%dd%d+%d", &dice_ct, &faces, &modifier);
-  if (faces < 1 || vals_scanned < 2 || vals_scanned > 3) {
-    const char *err_msg_start = "Error: Invalid dice: ";
-    size_t result_len = snprintf(
-      NULL, 0,
-      "%s%s",
-      err_msg_start, margv[1]
+  strbuf_puts(out, "```\n");
+  for (size_t b = 0; b < bin_ct; b++) {
+    int bar = (int) ((double) bins[b] * HISTOGRAM_BAR_WIDTH / max_bin + 0.5);
+    strbuf_printf(
+      out,
+      "%*s %6.2f%%",
+      label_width, labels[b], 100.0 * bins[b] / sim->trials
     );
-    result = malloc(result_len+1);
-    sprintf(result, "%s%s", err_msg_start, margv[1]);
-    return result;
-  }
-  if (vals_scanned == 2) modifier = 0;
-  srand(time(NULL));
-  diceroll_t diceroll = roll_dice(dice_ct, faces, modifier);
-  result = get_diceroll_result_str(diceroll);
-  save_diceroll(diceroll);
-  return result;
+    if (bar > 0) strbuf_putc(out, ' ');
+    for (int i = 0; i < bar; i++) strbuf_putc(out, '#');
+    strbuf_putc(out, '\n');
+  }
+  strbuf_puts(out, "```");
+}
+
+// parses a whole decimal number with nothing after it
+static int parse_u64(const char *str, uint64_t *dest) {
+  if (*str < '0' || *str > '9') return -1;
+  char *end;
+  *dest = strtoull(str, &end, 10);
+  return *end == '\0' ? 0 : -1;
 }
 
-static char *cmd_reroll(int margc, char **margv) {
-  char *result;
+static int cmd_simulate(
+  int margc,
+  const strview_t *margv,
+  const char *msg,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
+) {
+  if (margc < 2) {
+    strbuf_puts(out, "Error: Simulate what?");
+    return -1;
+  }
+  uint64_t trials = SIMULATE_DEFAULT_TRIALS;
+  if (margc > 2 && parse_u64(margv[2].ptr, &trials)) {
+    strbuf_printf(out, "Error: `%s` is not a number of trials.", margv[2].ptr);
+    return -1;
+  }
+  // without a seed, pick one and show it so the run can be repeated
+  uint64_t seed;
+  if (margc > 3) {
+    if (parse_u64(margv[3].ptr, &seed)) {
+      strbuf_printf(out, "Error: `%s` is not a valid seed.", margv[3].ptr);
+      return -1;
+    }
+  } else {
+    seed = dice_rng_next(dice_thread_rng());
+  }
 
-  diceroll_t last_roll = load_last_diceroll();
-  if (last_roll.value == -1) {
-    result = strdup("Backend error");
-    return result;
+  const char *err = NULL;
+  const dice_program_t *program = dice_expr_compile_cached(margv[1].ptr, &err);
+  if (program == NULL) {
+    strbuf_printf(
+      out,
+      "Syntax error: `\"%s\"` is not valid dice notation. %s",
+      margv[1].ptr, err
+    );
+    return -1;
+  }
+  dice_sim_t sim;
+  err = dice_simulate(program, trials, seed, &sim);
+  if (err != NULL) {
+    strbuf_printf(out, "Error: %s", err);
+    return -1;
   }
-  srand(time(NULL));
-  diceroll_t new_roll = roll_dice(last_roll.dice_ct, last_roll.faces, last_roll.modifier);
-  result = get_diceroll_result_str(new_roll);
-  save_diceroll(new_roll);
-  return result;
+
+  strbuf_printf(
+    out,
+    "Rolled `%s` %llu times (seed %llu): %lld to %lld, mean %.2f, "
+    "standard deviation %.2f.\n"
+    "Percentiles: 10%%: %lld, 25%%: %lld, 50%%: %lld, 75%%: %lld, 90%%: %lld.\n",
+    program->text, (unsigned long long) trials, (unsigned long long) seed,
+    sim.min, sim.min + (long long) sim.len - 1,
+    dice_sim_mean(&sim), dice_sim_stddev(&sim),
+    dice_sim_percentile(&sim, 0.10), dice_sim_percentile(&sim, 0.25),
+    dice_sim_percentile(&sim, 0.50), dice_sim_percentile(&sim, 0.75),
+    dice_sim_percentile(&sim, 0.90)
+  );
+  put_histogram(out, &sim);
+  dice_sim_free(&sim);
+  return 0;
 }
 
-static char *cmd_calcmod(int margc, char **margv) {
-  char *result;
+static int cmd_calcmod(
+  int margc,
+  const strview_t *margv,
+  const char *msg,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
+) {
   if (margc < 2) {
-    result = strdup(
+    strbuf_puts(
+      out,
       "Error: Specify an Ability score for which "
       "to calculate the modifier."
     );
-    return result;
+    return -1;
   }
 
   int ability_score;
-  int got_score = sscanf(margv[1], "%d", &ability_score);
+  int got_score = sscanf(margv[1].ptr, "%d", &ability_score);
   if (got_score < 1 || ability_score < 1) {
-    result = strdup("Error: this command requires a valid, positive, non-zero integer.");
-    return result;
+    strbuf_puts(out, "Error: this command requires a valid, positive, non-zero integer.");
+    return -1;
   }
 
   int modifier = -5;
@@ -494,73 +662,237 @@ static char *cmd_calcmod(int margc, char **margv) {
     modifier++;
   }
 
-  const char *result_start = "Modifier for Ability score ";
-  size_t result_len = snprintf(
-    NULL, 0,
-    "%s%d: %d",
-    result_start, ability_score, modifier
-  );
-  result = malloc(result_len+1);
-  sprintf(
-    result,
-    "%s%d: %d",
-    result_start, ability_score, modifier
-  );
-  return result;
+  strbuf_put_lit(out, "Modifier for Ability score ");
+  strbuf_append_int(out, ability_score);
+  strbuf_put_lit(out, ": ");
+  strbuf_append_int(out, modifier);
+  return 0;
 }
 
-// this function is called from main.py and handles most commands
-char *handle_message(const char *msg) {
+// formats a duration like "812ns", "3.4us", "12.0ms" or "2.50s"
+static void put_duration(strbuf_t *out, uint64_t ns) {
+  if (ns < 1000) {
+    strbuf_printf(out, "%luns", (unsigned long) ns);
+  } else if (ns < 1000000) {
+    strbuf_printf(out, "%.1fus", ns / 1e3);
+  } else if (ns < 1000000000) {
+    strbuf_printf(out, "%.1fms", ns / 1e6);
+  } else {
+    strbuf_printf(out, "%.2fs", ns / 1e9);
+  }
+}
+
+static int cmd_stats(
+  int margc,
+  const strview_t *margv,
+  const char *msg,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
+) {
+  stats_snapshot_t snapshot[STAT_ID_CT];
+  size_t n = get_command_stats(snapshot, STAT_ID_CT);
+  strbuf_puts(out, "Command stats since the backend was loaded:\n");
+  for (size_t i = 0; i < n; i++) {
+    if (snapshot[i].calls == 0) continue;
+    strbuf_printf(
+      out,
+      "`%s`: %lu calls, %lu errors; p50 ",
+      snapshot[i].name,
+      (unsigned long) snapshot[i].calls,
+      (unsigned long) snapshot[i].errors
+    );
+    put_duration(out, snapshot[i].p50_ns);
+    strbuf_puts(out, ", p90 ");
+    put_duration(out, snapshot[i].p90_ns);
+    strbuf_puts(out, ", p99 ");
+    put_duration(out, snapshot[i].p99_ns);
+    strbuf_puts(out, ", max ");
+    put_duration(out, snapshot[i].max_ns);
+    strbuf_putc(out, '\n');
+  }
+  return 0;
+}
+
+// every command handler has this signature so it can live in the table;
+// it appends its reply to out and returns -1 if the reply is an error
+typedef int (*cmd_handler_t)(
+  int margc,
+  const strview_t *margv,
+  const char *msg,
+  const msg_ctx_t *ctx,
+  strbuf_t *out
+);
+
+typedef struct cmd_entry {
+  const char *name;
+  size_t name_len;
+  cmd_handler_t handler;
+  stat_id_t stat; // where calls to this command are counted
+} cmd_entry_t;
+
+// defines cmd_dispatch_table[]; regenerate with `python3 gen_dispatch.py`
+#include "cmd_dispatch.h"
+
+// must match cmd_hash() in gen_dispatch.py (seeded 32-bit FNV-1a, folded)
+static unsigned int cmd_hash(const char *name, size_t len) {
+  unsigned int h = CMD_DISPATCH_SEED;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char) name[i];
+    h *= 16777619U;
+  }
+  return h ^ (h >> 16);
+}
+
+/**
+* Finds the table entry for the command named by cmd_name,
+* or returns NULL if there is no such command. This costs
+* one hash and one comparison no matter how many commands
+* the table holds.
+* =======================================================
+*/
+static const cmd_entry_t *lookup_command(const char *cmd_name, size_t len) {
+  const cmd_entry_t *entry =
+    cmd_dispatch_table + (cmd_hash(cmd_name, len) & (CMD_DISPATCH_SLOTS - 1));
+  if (entry->name == NULL || entry->name_len != len) return NULL;
+  if (memcmp(entry->name, cmd_name, len)) return NULL;
+  return entry;
+}
+
+// messages/args that fit in these are tokenized without touching the heap
+#define MSG_STACK_BUF_SIZE 2048
+#define MARGV_STACK_SLOTS 16
+
+typedef struct margv_buf {
+  char text_stack[MSG_STACK_BUF_SIZE];
+  strview_t argv_stack[MARGV_STACK_SLOTS];
+  char *text; // points to text_stack or to the heap
+  strview_t *argv; // points to argv_stack or to the heap
+  int argc;
+} margv_buf_t;
+
+/**
+* Splits msg on spaces into views stored in dest->argv.
+* The views point into dest->text, which is a copy of msg
+* with every separator overwritten by a '\0', so each view
+* is also a valid C string. Nothing is allocated unless msg
+* is very long or has more than MARGV_STACK_SLOTS args.
+* Returns 0 on success and -1 if an allocation failed.
+* =======================================================
+*/
+static int tokenize_message(margv_buf_t *dest, const char *msg) {
+  size_t msg_len = strlen(msg);
+  int argv_cap = MARGV_STACK_SLOTS;
+  dest->argc = 0;
+  dest->argv = dest->argv_stack;
+  dest->text = dest->text_stack;
+  if (msg_len >= MSG_STACK_BUF_SIZE) {
+    dest->text = malloc(msg_len + 1);
+    if (dest->text == NULL) return -1;
+  }
+  memcpy(dest->text, msg, msg_len + 1);
+
+  char *pos = dest->text;
+  while (1) {
+    while (*pos == ' ') *pos++ = '\0';
+    if (*pos == '\0') break;
+    if (dest->argc == argv_cap) {
+      strview_t *grown;
+      argv_cap *= 2;
+      if (dest->argv == dest->argv_stack) {
+        grown = malloc(argv_cap * sizeof(strview_t));
+        if (grown) memcpy(grown, dest->argv_stack, sizeof(dest->argv_stack));
+      } else {
+        grown = realloc(dest->argv, argv_cap * sizeof(strview_t));
+      }
+      if (grown == NULL) return -1;
+      dest->argv = grown;
+    }
+    char *start = pos;
+    while (*pos && *pos != ' ') pos++;
+    dest->argv[dest->argc++] = (strview_t){ start, pos - start };
+  }
+  return 0;
+}
+
+static void free_margv_buf(margv_buf_t *buf) {
+  if (buf->text != buf->text_stack) free(buf->text);
+  if (buf->argv != buf->argv_stack) free(buf->argv);
+}
+
+size_t handle_message_from(
+  const char *msg,
+  uint64_t user_id,
+  uint64_t channel_id,
+  strbuf_t *out
+) {
+  size_t reply_start = out->len;
+  const msg_ctx_t ctx = { user_id, channel_id };
+
   // "m" is for "message"
-  int margc = 1;
-  char **margv;
-
-  // count args
-  for (int i = 0; msg[i];) {
-    if (msg[i] == ' ') {
-      margc++;
-      while (msg[i] == ' ') i++;
+  margv_buf_t margv_buf;
+  if (tokenize_message(&margv_buf, msg)) {
+    free_margv_buf(&margv_buf);
+    strbuf_puts(out, "Memory allocation error");
+  } else {
+    int margc = margv_buf.argc;
+    const strview_t *margv = margv_buf.argv;
+
+    // process command
+    const cmd_entry_t *entry = NULL;
+    if (margc > 0)
+      entry = lookup_command(margv[0].ptr, margv[0].len);
+    uint64_t start_ns = stats_now_ns();
+    if (entry != NULL) {
+      int failed = entry->handler(margc, margv, msg, &ctx, out);
+      stats_record(entry->stat, stats_now_ns() - start_ns, failed);
     } else {
-      i++;
+      strbuf_printf(
+        out,
+        "Error: Unrecognized/malformed command `%s`.",
+        margc > 0 ? margv[0].ptr : ""
+      );
+      stats_record(STAT_UNRECOGNIZED, stats_now_ns() - start_ns, 1);
     }
+    free_margv_buf(&margv_buf);
   }
 
-  char *msg_copy = strdup(msg);
-  margv = malloc(margc * sizeof(char *));
-  char *token = strtok(msg_copy, " ");
-  for (int i = 0; token != NULL; i++) {
-    margv[i] = strdup(token);
-    token = strtok(NULL, " ");
-  }
-  free(msg_copy);
-
-  // process command
-  char *result;
-  if (!strcmp(margv[0], "%commands")) {
-    result = cmd_commands(margc, margv);
-  } else if (!strcmp(margv[0], "%cmdinfo")) {
-    result = cmd_cmdinfo(margc, margv);
-  } else if (!strcmp(margv[0], "%reverse")) {
-    result = cmd_reverse(margc, margv, msg);
-  } else if (!strcmp(margv[0], "%roll")) {
-    result = cmd_roll(margc, margv);
-  } else if (!strcmp(margv[0], "%reroll")) {
-    result = cmd_reroll(margc, margv);
-  } else if (!strcmp(margv[0], "%calcmod")) {
-    result = cmd_calcmod(margc, margv);
-  } else if (!strcmp(margv[0], "%dnd")) {
-    result = cmd_dnd(margc, margv);
-  } else {
-    const char *err_msg = "Error: Unrecognized/malformed command `";
-    const char *err_msg_end = "`.";
-    size_t size = strlen(err_msg) + strlen(margv[0]) + strlen(err_msg_end) + 1;
-    result = malloc(size);
-    snprintf(result, size, "%s%s%s", err_msg, margv[0], err_msg_end);
+  // terminate this reply so the next one can follow it in the same buffer
+  if (strbuf_putc(out, '\0')) {
+    // out of memory; drop whatever part of the reply made it in
+    out->len = reply_start;
+    if (out->data != NULL) out->data[out->len] = '\0';
   }
+  return reply_start;
+}
 
-  for (int i = 0; i < margc-1; i++) {
-    free(margv[i]);
+size_t handle_message_into(const char *msg, strbuf_t *out) {
+  return handle_message_from(msg, 0, 0, out);
+}
+
+// this function is called from main.py and handles most commands
+char *handle_message(const char *msg) {
+  strbuf_t reply;
+  strbuf_init(&reply);
+  handle_message_into(msg, &reply);
+  return strbuf_detach(&reply);
+}
+
+// batched version of handle_message_from(), for callers going through ctypes
+char *handle_messages(
+  const char **msgs,
+  const msg_ctx_t *ctxs,
+  size_t n,
+  size_t *offsets
+) {
+  strbuf_t replies;
+  strbuf_init(&replies);
+  for (size_t i = 0; i < n; i++) {
+    const msg_ctx_t ctx = ctxs != NULL ? ctxs[i] : (msg_ctx_t){ 0, 0 };
+    offsets[i] = handle_message_from(
+      msgs[i], ctx.user_id, ctx.channel_id, &replies
+    );
+    // a reply always ends with a '\0', so one that added nothing failed
+    if (replies.len == offsets[i]) offsets[i] = HANDLE_MESSAGES_FAILED;
   }
-  free(margv);
-  return result;
+  return strbuf_detach(&replies);
 }
@@ -1,7 +1,59 @@
 #ifndef TRYPTOBOT_H
 #define TRYPTOBOT_H
 
-char *load_file_to_str(const char *filename);
+#include <stddef.h>
+#include <stdint.h>
+#include "strbuf.h"
+
+/**
+ * Who sent a message and where, as Discord ids. Commands that keep
+ * state per user (like `%reroll`) key it on these; 0 stands for an
+ * unknown user or channel.
+ */
+typedef struct msg_ctx {
+  uint64_t user_id;
+  uint64_t channel_id;
+} msg_ctx_t;
+
 char *handle_message(const char *msg);
 
+/**
+ * Appends the reply to msg, followed by a '\0' that's counted in
+ * out->len, to *out and returns the offset in out->data where the
+ * reply starts. Handing the same buffer back for every message (after
+ * strbuf_clear(), or without clearing it to collect several replies)
+ * means steady-state handling allocates nothing for its output.
+ */
+size_t handle_message_into(const char *msg, strbuf_t *out);
+
+// handle_message_into() for a message from user_id in channel_id;
+// handle_message_into() itself passes 0 for both
+size_t handle_message_from(
+  const char *msg,
+  uint64_t user_id,
+  uint64_t channel_id,
+  strbuf_t *out
+);
+
+// offsets[i] of a message whose reply couldn't be allocated
+#define HANDLE_MESSAGES_FAILED ((size_t) -1)
+
+/**
+ * Handles msgs[0] through msgs[n-1] in one call, msgs[i] as sent by
+ * ctxs[i] (or by an unknown user in an unknown channel if ctxs is
+ * NULL). The replies are stored one after another, each
+ * '\0'-terminated, in the returned buffer, and the reply to msgs[i]
+ * starts at result + offsets[i] (offsets must have room for n
+ * entries), or offsets[i] is HANDLE_MESSAGES_FAILED if memory ran out
+ * while handling it. The whole batch is released with a single free()
+ * of the returned buffer. Returns NULL if memory couldn't be
+ * allocated.
+ */
+char *handle_messages(
+  const char **msgs,
+  const msg_ctx_t *ctxs,
+  size_t n,
+  size_t *offsets
+);
+
 #endif // TRYPTOBOT_H
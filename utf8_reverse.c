@@ -0,0 +1,269 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "grapheme_tables.h"
+#include "utf8_reverse.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_REVERSE_X86 1
+#endif
+
+/**
+ * After a vector kernel turns down a block (it had a non-ASCII byte
+ * or a '\r' in it), the next this many bytes go through the scalar
+ * path before it's tried again, so mixed text doesn't pay for a
+ * failed vector load at every ASCII char.
+ */
+#define VECTOR_RETRY_BYTES 16
+
+static inline int grapheme_prop(uint32_t cp) {
+  if (cp - GRAPHEME_HANGUL_FIRST <= GRAPHEME_HANGUL_LAST - GRAPHEME_HANGUL_FIRST) {
+    return (cp - GRAPHEME_HANGUL_FIRST) % GRAPHEME_HANGUL_T_COUNT ?
+           GCB_LVT : GCB_LV;
+  }
+  size_t i = (size_t) grapheme_stage1[cp >> GRAPHEME_BLOCK_SHIFT]
+             << GRAPHEME_BLOCK_SHIFT
+           | (cp & ((1U << GRAPHEME_BLOCK_SHIFT) - 1));
+  return grapheme_stage2[i >> 1] >> (i & 1) * 4 & 0xF;
+}
+
+/**
+ * Decodes the code point at the start of s (which has n bytes) into
+ * *cp and returns its length, or returns 0 if s doesn't start with
+ * well-formed UTF-8 (no overlong forms, surrogates or values past
+ * U+10FFFF).
+ */
+static int decode(const unsigned char *s, size_t n, uint32_t *cp) {
+  unsigned char c = s[0];
+  if (c < 0x80) {
+    *cp = c;
+    return 1;
+  }
+  int len;
+  unsigned char lo = 0x80, hi = 0xBF; // the range of the second byte
+  if (c < 0xC2) {
+    return 0;
+  } else if (c < 0xE0) {
+    len = 2;
+    *cp = c & 0x1F;
+  } else if (c < 0xF0) {
+    len = 3;
+    *cp = c & 0x0F;
+    if (c == 0xE0) lo = 0xA0;
+    if (c == 0xED) hi = 0x9F;
+  } else if (c < 0xF5) {
+    len = 4;
+    *cp = c & 0x07;
+    if (c == 0xF0) lo = 0x90;
+    if (c == 0xF4) hi = 0x8F;
+  } else {
+    return 0;
+  }
+  if (n < (size_t) len || s[1] < lo || s[1] > hi) return 0;
+  for (int i = 1; i < len; i++) {
+    if ((s[i] & 0xC0) != 0x80) return 0;
+    *cp = *cp << 6 | (s[i] & 0x3F);
+  }
+  return len;
+}
+
+/**
+ * Whether there's no cluster boundary between code points with the
+ * properties prev and cur. emoji is 2 if prev ends an
+ * `ExtPict Extend* ZWJ` sequence, and ri_ct is the number of regional
+ * indicators in a row that end at prev.
+ */
+static int joins(int prev, int cur, int emoji, int ri_ct) {
+  if (prev == GCB_CR) return cur == GCB_LF; // GB3, GB4
+  if (prev == GCB_LF || prev == GCB_CONTROL) return 0; // GB4
+  if (cur == GCB_CR || cur == GCB_LF || cur == GCB_CONTROL) return 0; // GB5
+  switch (prev) {
+    case GCB_L: // GB6
+      if (cur == GCB_L || cur == GCB_V || cur == GCB_LV || cur == GCB_LVT)
+        return 1;
+    break;
+    case GCB_LV: case GCB_V: // GB7
+      if (cur == GCB_V || cur == GCB_T) return 1;
+    break;
+    case GCB_LVT: case GCB_T: // GB8
+      if (cur == GCB_T) return 1;
+    break;
+    case GCB_PREPEND: // GB9b
+      return 1;
+  }
+  if (cur == GCB_EXTEND || cur == GCB_ZWJ || cur == GCB_SPACING_MARK)
+    return 1; // GB9, GB9a
+  if (cur == GCB_EXTENDED_PICTOGRAPHIC && emoji == 2) return 1; // GB11
+  // GB12, GB13: flags are pairs of regional indicators
+  return prev == GCB_REGIONAL_INDICATOR && cur == GCB_REGIONAL_INDICATOR
+      && ri_ct % 2 == 1;
+}
+
+// returns the index just past the grapheme cluster that starts at s[i]
+static size_t cluster_end(const unsigned char *s, size_t len, size_t i) {
+  uint32_t cp;
+  int n = decode(s + i, len - i, &cp);
+  if (n == 0) return i + 1; // a stray byte is a cluster of its own
+  int prev = grapheme_prop(cp);
+  int ri_ct = prev == GCB_REGIONAL_INDICATOR;
+  // 1 after `ExtPict Extend*`, 2 after `ExtPict Extend* ZWJ`
+  int emoji = prev == GCB_EXTENDED_PICTOGRAPHIC;
+  for (i += n; i < len; i += n) {
+    // nothing below U+0300 (an ASCII byte or a lead byte below 0xCC)
+    // joins onto what's before it, except after CR or a prepended mark
+    if (s[i] < 0xCC && prev != GCB_CR && prev != GCB_PREPEND) break;
+    n = decode(s + i, len - i, &cp);
+    if (n == 0) break;
+    int cur = grapheme_prop(cp);
+    if (!joins(prev, cur, emoji, ri_ct)) break;
+    if (cur == GCB_EXTENDED_PICTOGRAPHIC) emoji = 1;
+    else if (emoji == 1 && cur == GCB_ZWJ) emoji = 2;
+    else if (emoji != 1 || cur != GCB_EXTEND) emoji = 0;
+    ri_ct = cur == GCB_REGIONAL_INDICATOR ? ri_ct + 1 : 0;
+    prev = cur;
+  }
+  return i;
+}
+
+/**
+ * The vector kernels reverse whole blocks of src, starting at i (which
+ * must be the start of a cluster), for as long as every byte of the
+ * block is a cluster of its own: all ASCII, no '\r' (which pairs with
+ * a following '\n'), and the byte after the block is ASCII too, so
+ * nothing like a combining mark attaches to the last one. They return
+ * the index of the first byte they didn't handle.
+ */
+typedef size_t (*reverse_ascii_fn_t)(
+  unsigned char *, const unsigned char *, size_t, size_t
+);
+
+// without a vector kernel, every byte is left to utf8_reverse()'s loop
+static size_t reverse_ascii_scalar(
+  __attribute__((unused)) unsigned char *dest,
+  __attribute__((unused)) const unsigned char *src,
+  size_t i,
+  __attribute__((unused)) size_t len
+) {
+  return i;
+}
+
+#ifdef UTF8_REVERSE_X86
+
+/**
+ * Always inlined, so that when reverse_ascii_avx2() finishes with it
+ * it's compiled as AVX (VEX-encoded) code; mixing in legacy SSE code
+ * right after 256-bit AVX code is very slow on many CPUs.
+ */
+__attribute__((target("ssse3"), always_inline))
+static inline size_t reverse_ascii_16(
+  unsigned char *dest,
+  const unsigned char *src,
+  size_t i,
+  size_t len
+) {
+  const __m128i reverse =
+    _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  const __m128i cr = _mm_set1_epi8('\r');
+  for (; i + 16 <= len && (i + 16 == len || src[i + 16] < 0x80); i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+    if (_mm_movemask_epi8(v) | _mm_movemask_epi8(_mm_cmpeq_epi8(v, cr))) break;
+    _mm_storeu_si128(
+      (__m128i *) (dest + len - i - 16),
+      _mm_shuffle_epi8(v, reverse)
+    );
+  }
+  return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t reverse_ascii_ssse3(
+  unsigned char *dest,
+  const unsigned char *src,
+  size_t i,
+  size_t len
+) {
+  return reverse_ascii_16(dest, src, i, len);
+}
+
+__attribute__((target("avx2")))
+static size_t reverse_ascii_avx2(
+  unsigned char *dest,
+  const unsigned char *src,
+  size_t i,
+  size_t len
+) {
+  // vpshufb only shuffles within each 128-bit lane; the lanes are
+  // swapped afterwards
+  const __m256i reverse = _mm256_setr_epi8(
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+  );
+  const __m256i cr = _mm256_set1_epi8('\r');
+  for (; i + 32 <= len && (i + 32 == len || src[i + 32] < 0x80); i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (src + i));
+    if (_mm256_movemask_epi8(v) | _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cr)))
+      break;
+    v = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, reverse), 0x4E);
+    _mm256_storeu_si256((__m256i *) (dest + len - i - 32), v);
+  }
+  return reverse_ascii_16(dest, src, i, len);
+}
+
+#endif // UTF8_REVERSE_X86
+
+// set once, by the first utf8_reverse() on any thread, to the widest
+// kernel this CPU supports
+static pthread_once_t reverse_ascii_once = PTHREAD_ONCE_INIT;
+static reverse_ascii_fn_t reverse_ascii = NULL;
+
+static void resolve_reverse_ascii(void) {
+#ifdef UTF8_REVERSE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) reverse_ascii = reverse_ascii_avx2;
+  else if (__builtin_cpu_supports("ssse3")) reverse_ascii = reverse_ascii_ssse3;
+  else reverse_ascii = reverse_ascii_scalar;
+#else
+  reverse_ascii = reverse_ascii_scalar;
+#endif
+}
+
+void utf8_reverse(char *dest, const char *src, size_t len) {
+  const unsigned char *s = (const unsigned char *) src;
+  unsigned char *d = (unsigned char *) dest;
+  pthread_once(&reverse_ascii_once, resolve_reverse_ascii);
+  size_t vector_from = 0;
+  size_t i = 0;
+  while (i < len) {
+    if (s[i] < 0x80) {
+      if (i >= vector_from) {
+        i = reverse_ascii(d, s, i, len);
+        if (i == len) break;
+        vector_from = i + VECTOR_RETRY_BYTES;
+      }
+      // an ASCII char other than '\r' followed by another ASCII char
+      if (s[i] < 0x80 && s[i] != '\r' && (i + 1 == len || s[i + 1] < 0x80)) {
+        d[len - 1 - i] = s[i];
+        i++;
+        continue;
+      }
+    }
+    // a char below U+0300 (Latin-1, Latin Extended, IPA) that's
+    // followed by another one or by ASCII
+    if (s[i] >= 0xC2 && s[i] < 0xCC && i + 1 < len && (s[i + 1] & 0xC0) == 0x80
+        && (i + 2 == len || s[i + 2] < 0xCC)) {
+      d[len - 2 - i] = s[i];
+      d[len - 1 - i] = s[i + 1];
+      i += 2;
+      continue;
+    }
+    size_t end = cluster_end(s, len, i);
+    if (end - i <= 4) {
+      // most clusters are a single code point; skip the call to memcpy
+      for (size_t j = i; j < end; j++) d[len - end + j - i] = s[j];
+    } else {
+      memcpy(d + len - end, s + i, end - i);
+    }
+    i = end;
+  }
+}
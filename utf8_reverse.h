@@ -0,0 +1,18 @@
+#ifndef UTF8_REVERSE_H
+#define UTF8_REVERSE_H
+
+#include <stddef.h>
+
+/**
+ * Writes the len bytes of src to dest (which must have room for len
+ * bytes, and must not overlap src) with the order of their grapheme
+ * clusters reversed, so accented letters, emoji ZWJ sequences, flags
+ * and Hangul syllables come out intact. Clusters are found with the
+ * extended grapheme cluster rules of UAX #29, using the tables in
+ * grapheme_tables.h. Bytes that aren't valid UTF-8 are moved one at a
+ * time. Runs of plain ASCII are reversed a vector at a time. Always
+ * writes exactly len bytes, and doesn't add a '\0'.
+ */
+void utf8_reverse(char *dest, const char *src, size_t len);
+
+#endif // UTF8_REVERSE_H
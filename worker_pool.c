@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/eventfd.h>
+#include "tryptobot.h"
+#include "strbuf.h"
+#include "worker_pool.h"
+
+/**
+ * Bounded lock-free multi-producer/multi-consumer queue (Dmitry
+ * Vyukov's design). Each cell's sequence number says whose turn it
+ * is: a producer may fill cell i when seq == pos, and a consumer may
+ * empty it when seq == pos + 1.
+ */
+typedef struct mpmc_cell {
+  atomic_size_t seq;
+  uint64_t tag;
+  msg_ctx_t ctx; // who sent the message; unused for replies
+  char *text;
+} mpmc_cell_t;
+
+typedef struct mpmc_queue {
+  mpmc_cell_t *cells;
+  size_t mask;
+  // kept on separate cache lines so producers and consumers don't collide
+  _Alignas(64) atomic_size_t enqueue_pos;
+  _Alignas(64) atomic_size_t dequeue_pos;
+} mpmc_queue_t;
+
+static int mpmc_init(mpmc_queue_t *q, size_t capacity) {
+  q->cells = malloc(capacity * sizeof(mpmc_cell_t));
+  if (q->cells == NULL) return -1;
+  q->mask = capacity - 1;
+  for (size_t i = 0; i < capacity; i++) {
+    atomic_init(&q->cells[i].seq, i);
+  }
+  atomic_init(&q->enqueue_pos, 0);
+  atomic_init(&q->dequeue_pos, 0);
+  return 0;
+}
+
+static int mpmc_push(
+  mpmc_queue_t *q,
+  uint64_t tag,
+  msg_ctx_t ctx,
+  char *text
+) {
+  size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+  mpmc_cell_t *cell;
+  while (1) {
+    cell = q->cells + (pos & q->mask);
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+        &q->enqueue_pos, &pos, pos + 1,
+        memory_order_relaxed, memory_order_relaxed
+      )) break;
+    } else if (diff < 0) {
+      return -1; // full
+    } else {
+      pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    }
+  }
+  cell->tag = tag;
+  cell->ctx = ctx;
+  cell->text = text;
+  atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+  return 0;
+}
+
+static int mpmc_pop(
+  mpmc_queue_t *q,
+  uint64_t *tag,
+  msg_ctx_t *ctx,
+  char **text
+) {
+  size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+  mpmc_cell_t *cell;
+  while (1) {
+    cell = q->cells + (pos & q->mask);
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+        &q->dequeue_pos, &pos, pos + 1,
+        memory_order_relaxed, memory_order_relaxed
+      )) break;
+    } else if (diff < 0) {
+      return -1; // empty
+    } else {
+      pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    }
+  }
+  *tag = cell->tag;
+  *ctx = cell->ctx;
+  *text = cell->text;
+  atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+  return 0;
+}
+
+static struct {
+  mpmc_queue_t submissions; // holds messages
+  mpmc_queue_t completions; // holds replies
+  sem_t pending; // counts queued submissions, so idle workers can sleep
+  atomic_size_t in_flight; // submitted but not yet polled
+  size_t capacity;
+  atomic_int running;
+  atomic_int stopping;
+  int event_fd;
+  pthread_t *threads;
+  size_t thread_ct;
+} pool;
+
+// queued in place of a reply that couldn't be allocated
+static char out_of_memory_reply[] = "Backend error: out of memory";
+
+static void *worker_main(void *arg) {
+  while (1) {
+    sem_wait(&pool.pending);
+    if (atomic_load(&pool.stopping)) return NULL;
+    uint64_t tag;
+    msg_ctx_t ctx;
+    char *msg;
+    /* Every post means a message has been published, but the pop can
+       still fail briefly while an earlier producer is mid-push, so
+       retry instead of going back to sleep and losing the wakeup. */
+    while (mpmc_pop(&pool.submissions, &tag, &ctx, &msg)) {
+      if (atomic_load(&pool.stopping)) return NULL;
+      sched_yield();
+    }
+    strbuf_t reply;
+    strbuf_init(&reply);
+    handle_message_from(msg, ctx.user_id, ctx.channel_id, &reply);
+    free(msg);
+    char *text = strbuf_detach(&reply);
+    if (text == NULL) text = out_of_memory_reply;
+    /* in_flight never exceeds the capacity of either queue, so
+       there is always room for the reply */
+    mpmc_push(&pool.completions, tag, ctx, text);
+    uint64_t one = 1;
+    if (write(pool.event_fd, &one, sizeof(one)) < 0) {
+      perror("worker_pool: write to eventfd");
+    }
+  }
+  return NULL;
+}
+
+int start_worker_pool(size_t thread_ct, size_t capacity) {
+  if (atomic_load(&pool.running) || thread_ct == 0 || capacity == 0)
+    return -1;
+
+  size_t rounded = 1;
+  while (rounded < capacity) rounded *= 2;
+  pool.capacity = rounded;
+  if (mpmc_init(&pool.submissions, rounded)) return -1;
+  if (mpmc_init(&pool.completions, rounded)) {
+    free(pool.submissions.cells);
+    return -1;
+  }
+  sem_init(&pool.pending, 0, 0);
+  atomic_init(&pool.in_flight, 0);
+  atomic_store(&pool.stopping, 0);
+  pool.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  pool.threads = malloc(thread_ct * sizeof(pthread_t));
+  if (pool.event_fd < 0 || pool.threads == NULL) {
+    if (pool.event_fd >= 0) close(pool.event_fd);
+    free(pool.threads);
+    free(pool.submissions.cells);
+    free(pool.completions.cells);
+    sem_destroy(&pool.pending);
+    return -1;
+  }
+
+  pool.thread_ct = 0;
+  for (size_t i = 0; i < thread_ct; i++) {
+    if (pthread_create(pool.threads + i, NULL, worker_main, NULL)) break;
+    pool.thread_ct++;
+  }
+  if (pool.thread_ct == 0) {
+    close(pool.event_fd);
+    free(pool.threads);
+    free(pool.submissions.cells);
+    free(pool.completions.cells);
+    sem_destroy(&pool.pending);
+    return -1;
+  }
+  atomic_store(&pool.running, 1);
+  return pool.event_fd;
+}
+
+int submit_message(
+  const char *msg,
+  uint64_t user_id,
+  uint64_t channel_id,
+  uint64_t tag
+) {
+  if (!atomic_load(&pool.running) || atomic_load(&pool.stopping)) return -1;
+  if (atomic_fetch_add(&pool.in_flight, 1) >= pool.capacity) {
+    atomic_fetch_sub(&pool.in_flight, 1);
+    return -1;
+  }
+  char *copy = strdup(msg);
+  msg_ctx_t ctx = { user_id, channel_id };
+  if (copy == NULL || mpmc_push(&pool.submissions, tag, ctx, copy)) {
+    free(copy);
+    atomic_fetch_sub(&pool.in_flight, 1);
+    return -1;
+  }
+  sem_post(&pool.pending);
+  return 0;
+}
+
+size_t poll_completions(completion_t *out, size_t max) {
+  if (!atomic_load(&pool.running)) return 0;
+  size_t n = 0;
+  msg_ctx_t ctx;
+  while (n < max
+         && !mpmc_pop(&pool.completions, &out[n].tag, &ctx, &out[n].reply)) {
+    out[n].error = NULL;
+    if (out[n].reply == out_of_memory_reply) {
+      out[n].reply = NULL;
+      out[n].error = out_of_memory_reply;
+    }
+    n++;
+  }
+  atomic_fetch_sub(&pool.in_flight, n);
+  return n;
+}
+
+void stop_worker_pool(void) {
+  if (!atomic_load(&pool.running)) return;
+  atomic_store(&pool.stopping, 1);
+  for (size_t i = 0; i < pool.thread_ct; i++) sem_post(&pool.pending);
+  for (size_t i = 0; i < pool.thread_ct; i++) {
+    pthread_join(pool.threads[i], NULL);
+  }
+
+  uint64_t tag;
+  msg_ctx_t ctx;
+  char *text;
+  while (!mpmc_pop(&pool.submissions, &tag, &ctx, &text)) free(text);
+  while (!mpmc_pop(&pool.completions, &tag, &ctx, &text)) {
+    if (text != out_of_memory_reply) free(text);
+  }
+  atomic_store(&pool.running, 0);
+  close(pool.event_fd);
+  free(pool.threads);
+  free(pool.submissions.cells);
+  free(pool.completions.cells);
+  sem_destroy(&pool.pending);
+}
@@ -0,0 +1,53 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct completion {
+  uint64_t tag; // the tag that was passed to submit_message()
+  // heap-allocated, and the caller must free() it; NULL if there wasn't
+  // memory for the reply, in which case error says so
+  char *reply;
+  const char *error; // static; NULL unless reply is NULL
+} completion_t;
+
+/**
+ * Starts `thread_ct` threads that run handle_message_from() on
+ * submitted messages. At most `capacity` (rounded up to a power of 2)
+ * messages can be in flight, i.e. submitted but not yet returned by
+ * poll_completions(). Returns an eventfd that becomes readable
+ * whenever replies are waiting, or -1 on failure (including if the
+ * pool is already running).
+ */
+int start_worker_pool(size_t thread_ct, size_t capacity);
+
+/**
+ * Queues a copy of msg, sent by user_id in channel_id, to be handled
+ * on the pool. Never blocks. Returns 0 on success, or -1 if the pool
+ * isn't running or is full, in which case the caller should handle
+ * the message some other way.
+ */
+int submit_message(
+  const char *msg,
+  uint64_t user_id,
+  uint64_t channel_id,
+  uint64_t tag
+);
+
+/**
+ * Moves up to max finished replies into out and returns how many were
+ * moved. Never blocks. Read the eventfd before calling this so that
+ * no wakeup is missed.
+ */
+size_t poll_completions(completion_t *out, size_t max);
+
+/**
+ * Stops the workers once they finish the messages they're handling;
+ * they don't start on any more. Messages still queued and replies
+ * that haven't been polled are freed without being handled or
+ * returned.
+ */
+void stop_worker_pool(void);
+
+#endif // WORKER_POOL_H